@@ -19,6 +19,7 @@
 #include "profile.hh"
 #include "bench.hh"
 #include "predictor.hh"
+#include "hotkey.hh"
 
 struct mapreduce_appbase;
 struct map_bucket_manager_base;
@@ -31,6 +32,12 @@ struct mapreduce_appbase {
     virtual void map_function(split_t *) = 0;
     virtual bool split(split_t *ret, int ncore) = 0;
     virtual int key_compare(const void *, const void *) = 0;
+    /* @brief: optional function re-cutting the input from split @first on
+       into splits of about @nbyte bytes. Return false if the splits can
+       not be resized. */
+    virtual bool resize_splits(size_t first, size_t nbyte) {
+        return false;
+    }
     virtual ~mapreduce_appbase();
     /* @brief: optional function invoked for each new key. */
     virtual void *key_copy(void *k, size_t len) {
@@ -40,6 +47,21 @@ struct mapreduce_appbase {
     /* @brief: if you have implemented key_copy, you should also implement key_free */
     virtual void key_free(void *k) {}
 
+    /* @brief: optional function called once sampling is over, with the
+       number of keys predicted for the whole input, the number of reduce
+       tasks derived from it, and the bytes of heap the pairs emitted from
+       the @sampled_bytes bytes of sampled input hold. map_function can
+       tell the sampled splits apart with sampling(). */
+    virtual void sample_done(size_t predicted_nkey, size_t nreduce_task,
+                             size_t sampled_bytes, size_t sampled_heap) {}
+    bool sampling() const {
+        return sampling_;
+    }
+    /* @brief: optional function called by sched_run_no_final once its
+       map phase is over, before the results kept from the previous run
+       are emitted again: until then, they are left untouched. */
+    virtual void map_done() {}
+
     /* @brief: default partition function that partition keys into reduce/group buckets */
     virtual unsigned partition(void *k, int length) {
         size_t h = 5381;
@@ -52,6 +74,22 @@ struct mapreduce_appbase {
     void set_ncore(int ncore) {
         ncore_ = ncore;
     }
+    /* @brief: reuse the number of reduce tasks predicted by the first
+       sampled run instead of sampling again, e.g. for many input files
+       sharing a key distribution. */
+    void set_sample_reuse(bool reuse) {
+        reuse_sample_ = reuse;
+    }
+    /* @brief: order of the final output. output_unordered concatenates the
+       output of the reduce tasks, output_key_order merges it as the reduce
+       phase leaves it sorted by key, and output_compare_order sorts it by
+       final_output_compare. With a @limit, only the first @limit pairs of
+       the output are ordered. */
+    enum { output_unordered, output_key_order, output_compare_order };
+    void set_output_order(int order, size_t limit = 0) {
+        output_order_ = order;
+        output_limit_ = limit;
+    }
     static void initialize();
     static void deinitialize();
     int sched_run_no_final();
@@ -84,14 +122,47 @@ struct mapreduce_appbase {
     virtual void reset();
     virtual void verify_before_run() = 0;
     uint64_t sched_sample();
+    size_t predict_reduce_tasks();
     virtual bool skip_reduce_or_group_phase() = 0;
     virtual void set_final_result() = 0;
     int map_worker();
     int reduce_worker();
     int merge_worker();
+    void plan_reduce_tasks();
     static void *base_worker(void *arg);
     void run_phase(int phase, int ncore, uint64_t &t, int first_task = 0);
-    map_bucket_manager_base *create_map_bucket_manager(int nrow, int ncol);
+    /* @brief: leave the final output in the first reduce bucket, in the
+       order set by set_output_order */
+    void merge_phase(uint64_t &t);
+    map_bucket_manager_base *create_map_bucket_manager(int nrow, int ncol,
+                                                       map_bucket_manager_base *&spare);
+    /* @brief: keep the emptied bucket managers for the next run */
+    void release_map_buckets();
+    /* @brief: fold the map throughput measured since the last call into
+       the running per core estimate. */
+    void update_map_rate();
+    /* @brief: size the map tasks left after sampling to take about
+       target_map_task_ms each at the estimated throughput. */
+    void resize_map_tasks();
+    /* @brief: pick the keys that carry more than 1/(2 * ncore) of the
+       sampled pairs from the workers' sketches. */
+    void find_hot_keys();
+    /* @brief: salt added to the hash of a hot key emitted by @lcpu */
+    unsigned hot_key_salt(void *k, int keylen, unsigned hash, int lcpu);
+    /* @brief: the partial slot of the current reduce task for the hot key
+       @p, or NULL if @p is not hot. */
+    hot_key::partial *hot_key_partial(const keyvals_t &p);
+    /* @brief: reduce the partials of the hot keys into their home columns */
+    virtual void merge_hot_keys() {}
+    /* @brief: whether @task is the home column of a salted hot key, whose
+       output is only complete once merge_hot_keys has run. */
+    bool hot_home(int task);
+    /* @brief: called once the output of reduce task @task is complete,
+       by the thread that ran it, or after merge_hot_keys for the home
+       columns of the hot keys. */
+    virtual void reduce_task_done(int task) {}
+    void hot_homes_done();
+    void free_hot_keys();
 
     int nreduce_or_group_task_;
     enum { min_group_or_reduce_task_per_core = 16,
@@ -100,10 +171,22 @@ struct mapreduce_appbase {
     enum { sample_percent = 5 };
     enum { combiner_threshold = 8 };
     enum { expected_keys_per_bucket = 10 };
+    enum { target_map_task_ms = 10,
+           min_map_task_per_core = 4,
+           max_map_task_per_core = 256 };
+    enum { max_hot_keys = 16, min_hot_key_pairs = 1000 };
+
+    hot_key hot_[max_hot_keys];
+    int nhot_;
+    int hot_fanout_;   // columns a hot key is salted over, 0 if disabled
 
   private:
     uint64_t nsample_;
     int merge_ncore_;
+    bool merge_presort_;   // first merge round, buckets not sorted yet
+    bool merge_heads_;     // only sort the heads of the buckets
+    int output_order_;
+    size_t output_limit_;
 
     int ncore_;   
     uint64_t total_sample_time_;
@@ -117,13 +200,31 @@ struct mapreduce_appbase {
         return atomic_add32_ret(&next_task_);
     }
     int next_task_;
+    /* With workers on several NUMA nodes, reduce tasks are queued on the
+       node holding most of their map output. Workers drain their own
+       node's queue first, then steal from the other nodes. */
+    struct __attribute__ ((aligned(JOS_CLINE))) node_queue {
+        int next_;
+        int end_;
+    };
+    int next_reduce_task(int lcpu);
+    node_queue rq_[JOS_NCPU];
+    int nnode_;
+    xarray<int> reduce_order_;
     int phase_;
     xarray<split_t> ma_;
 
     map_bucket_manager_base *m_;
     map_bucket_manager_base *sample_;
+    map_bucket_manager_base *spare_m_;
+    map_bucket_manager_base *spare_sample_;
     bool sampling_;
+    bool reuse_sample_;
+    size_t sampled_ntask_;
     predictor e_[JOS_NCPU];
+    double cycles_per_byte_;   // map cost per core, averaged over runs
+    double pairs_per_cycle_;   // emitted pairs per core, from sampling
+    hotkey_sketch *sketch_;    // per worker, while sampling
 };
 
 struct static_appbase {
@@ -20,10 +20,14 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <malloc.h>
 
 #include "application.hh"
 #include "bench.hh"
 #include "thread.hh"
+#include "cpumap.hh"
 #include "reduce_bucket_manager.hh"
 #include "map_bucket_manager.hh"
 #include "btree.hh"
@@ -49,15 +53,28 @@ void cprint(const char *key, uint64_t v, const char *delim) {
 }
 
 mapreduce_appbase::mapreduce_appbase() 
-    : nsample_(), merge_ncore_(), ncore_(),
+    : nsample_(), merge_ncore_(), merge_presort_(false), merge_heads_(false),
+      output_order_(output_compare_order), output_limit_(), ncore_(),
       total_sample_time_(), total_map_time_(), total_reduce_time_(),
       total_merge_time_(), total_real_time_(), clean_(true),
-      next_task_(), phase_(), m_(NULL), sample_(NULL), sampling_(false) {
+      next_task_(), nnode_(), phase_(), m_(NULL), sample_(NULL),
+      spare_m_(NULL), spare_sample_(NULL), sampling_(false),
+      reuse_sample_(false), sampled_ntask_(), cycles_per_byte_(),
+      pairs_per_cycle_(), sketch_(NULL) {
     bzero(e_, sizeof(e_));
+    nhot_ = hot_fanout_ = 0;
+    for (int i = 0; i < max_hot_keys; ++i) {
+        hot_[i].key_ = NULL;
+        for (int s = 0; s < hot_key::max_fanout; ++s)
+            hot_[i].part_[s].key_ = NULL;
+    }
 }
 
 mapreduce_appbase::~mapreduce_appbase() {
     reset();
+    delete spare_m_;
+    delete spare_sample_;
+    free_hot_keys();
 }
 
 void mapreduce_appbase::initialize() {
@@ -68,7 +85,14 @@ void mapreduce_appbase::deinitialize() {
     mthread_finalize();
 }
 
-map_bucket_manager_base *mapreduce_appbase::create_map_bucket_manager(int nrow, int ncol) {
+map_bucket_manager_base *mapreduce_appbase::create_map_bucket_manager(int nrow, int ncol,
+                                                                     map_bucket_manager_base *&spare) {
+    if (spare && spare->nrow() == size_t(nrow) && spare->ncol() == size_t(ncol)) {
+        map_bucket_manager_base *m = spare;
+        spare = NULL;
+        m->global_init(nrow, ncol);
+        return m;
+    }
     enum { index_append, index_btree, index_array };
     int index = (application_type() == atype_maponly) ? index_append : DEFAULT_MAP_DS;
     map_bucket_manager_base *m = NULL;
@@ -102,7 +126,10 @@ int mapreduce_appbase::map_worker() {
         m_->rehash(ti->cur_core_, sample_);
     int n, next;
     for (n = 0; (next = next_task()) < int(ma_.size()); ++n) {
-	map_function(ma_.at(next));
+        split_t *ma = ma_.at(next);
+        uint64_t t0 = read_tsc();
+	map_function(ma);
+        e_[ti->cur_core_].task_timed(ma->length, read_tsc() - t0);
         if (sampling_)
 	    e_[ti->cur_core_].task_finished();
     }
@@ -111,26 +138,89 @@ int mapreduce_appbase::map_worker() {
     return n;
 }
 
+int mapreduce_appbase::next_reduce_task(int lcpu) {
+    if (nnode_ <= 1)
+        return next_task();
+    const int node = cpumap_node(lcpu);
+    for (int i = 0; i < nnode_; ++i) {
+        node_queue &q = rq_[(node + i) % nnode_];
+        if (q.next_ >= q.end_)
+            continue;
+        int pos = atomic_add32_ret(&q.next_);
+        if (pos < q.end_)
+            return reduce_order_[pos];
+    }
+    return nreduce_or_group_task_;
+}
+
+void mapreduce_appbase::plan_reduce_tasks() {
+    nnode_ = 0;
+    for (int i = 0; i < ncore_; ++i)
+        nnode_ = std::max(nnode_, cpumap_node(i) + 1);
+    nnode_ = std::min(nnode_, int(JOS_NCPU));
+    if (nnode_ <= 1)
+        return;
+    // home node of each column: the node whose workers emitted most keys
+    xarray<int> home(nreduce_or_group_task_);
+    size_t nkeys[JOS_NCPU];
+    for (int c = 0; c < nreduce_or_group_task_; ++c) {
+        bzero(nkeys, sizeof(nkeys[0]) * nnode_);
+        for (int r = 0; r < ncore_; ++r)
+            nkeys[cpumap_node(r) % nnode_] += m_->bucket_size(r, c);
+        home[c] = std::max_element(nkeys, nkeys + nnode_) - nkeys;
+    }
+    // counting sort of the tasks by home node
+    bzero(rq_, sizeof(rq_));
+    for (int c = 0; c < nreduce_or_group_task_; ++c)
+        ++rq_[home[c]].end_;
+    for (int i = 0, start = 0; i < nnode_; ++i) {
+        rq_[i].next_ = start;
+        start += rq_[i].end_;
+        rq_[i].end_ = rq_[i].next_;
+    }
+    reduce_order_.resize(nreduce_or_group_task_);
+    for (int c = 0; c < nreduce_or_group_task_; ++c)
+        reduce_order_[rq_[home[c]].end_++] = c;
+}
+
 int mapreduce_appbase::reduce_worker() {
+    threadinfo *ti = threadinfo::current();
     int n, next;
-    for (n = 0; (next = next_task()) < nreduce_or_group_task_; ++n) {
+    for (n = 0; (next = next_reduce_task(ti->cur_core_)) < nreduce_or_group_task_; ++n) {
         get_reduce_bucket_manager()->set_current_reduce_task(next);
 	m_->do_reduce_task(next);
+        if (!hot_home(next))
+            reduce_task_done(next);
     }
     return n;
 }
 
+bool mapreduce_appbase::hot_home(int task) {
+    for (int i = 0; i < nhot_ && hot_fanout_; ++i)
+        if (int(hot_[i].hash_ % nreduce_or_group_task_) == task)
+            return true;
+    return false;
+}
+
+void mapreduce_appbase::hot_homes_done() {
+    for (int task = 0; task < nreduce_or_group_task_; ++task)
+        if (hot_home(task))
+            reduce_task_done(task);
+}
+
 int mapreduce_appbase::merge_worker() {
     reduce_bucket_manager_base *r = get_reduce_bucket_manager();
     threadinfo *ti = threadinfo::current();
-    if (application_type() == atype_maponly || !skip_reduce_or_group_phase())
-	r->merge_reduced_buckets(merge_ncore_, ti->cur_core_);
+    if (merge_heads_)
+        r->sort_heads(merge_ncore_, ti->cur_core_, output_limit_);
+    else if (application_type() == atype_maponly || !skip_reduce_or_group_phase())
+	r->merge_reduced_buckets(merge_ncore_, ti->cur_core_, merge_presort_);
     else {
         r->set_current_reduce_task(ti->cur_core_);
         // must use psrs
         m_->psrs_output_and_reduce(merge_ncore_, ti->cur_core_);
         // merge reduced buckets
-	r->merge_reduced_buckets(merge_ncore_, ti->cur_core_);
+	r->merge_reduced_buckets(merge_ncore_, ti->cur_core_, false);
     }
     return 1;
 }
@@ -185,22 +275,96 @@ void mapreduce_appbase::run_phase(int phase, int ncore, uint64_t &t, int first_t
     t += read_tsc() - t0;
 }
 
+void mapreduce_appbase::merge_phase(uint64_t &t) {
+    reduce_bucket_manager_base *r = get_reduce_bucket_manager();
+    const bool ordered = output_order_ != output_unordered;
+    if (!skip_reduce_or_group_phase() && (!ordered || output_limit_)) {
+        // no merge sort: each cpu sorts the heads of its buckets if needed
+        if (ordered) {
+            merge_heads_ = true;
+            merge_ncore_ = std::max(1, std::min(int(r->size()), ncore_));
+            run_phase(MERGE, merge_ncore_, t);
+            merge_heads_ = false;
+        }
+        uint64_t t0 = read_tsc();
+        r->concat(ordered ? output_limit_ : 0);
+        t += read_tsc() - t0;
+        return;
+    }
+    const int use_psrs = USE_PSRS;
+    if (use_psrs) {
+        merge_ncore_ = ncore_;
+	run_phase(MERGE, merge_ncore_, t);
+    } else {
+	merge_ncore_ = std::min(int(r->size()) / 2, ncore_);
+        merge_presort_ = !skip_reduce_or_group_phase()
+            && output_order_ == output_compare_order;
+        if (merge_presort_ && r->size() == 1) {
+            merge_ncore_ = 1;
+            run_phase(MERGE, merge_ncore_, t);
+        }
+	while (r->size() > 1) {
+	    run_phase(MERGE, merge_ncore_, t);
+            merge_presort_ = false;
+            r->trim(merge_ncore_);
+	    merge_ncore_ /= 2;
+	}
+        merge_presort_ = false;
+    }
+}
+
+namespace {
+/* @brief: bytes allocated from the heap, over all the arenas */
+size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+#else
+    struct mallinfo mi = mallinfo();
+#endif
+    return size_t(mi.uordblks) + size_t(mi.hblkhd);
+}
+}
+
 size_t mapreduce_appbase::sched_sample() {
     nsample_ = std::max(size_t(1), sample_percent * ma_.size() / 100);
     const size_t nma = ma_.size();
     assert(nma);
+    // splits may shrink towards the tail, so extrapolate by bytes
+    size_t nbyte = 0, nsample_byte = 0;
+    for (size_t i = 0; i < nma; ++i) {
+        if (i == nsample_)
+            nsample_byte = nbyte;
+        nbyte += ma_[i].length;
+    }
+    const size_t ntask = nsample_byte ? nsample_ * nbyte / nsample_byte : nma;
     ma_.trim(nsample_);
 
     sampling_ = true;
-    sample_ = create_map_bucket_manager(ncore_, default_sample_hashtable_size);
+    bzero(e_, sizeof(e_));
+    if (application_type() == atype_mapreduce) {
+        sketch_ = new hotkey_sketch[ncore_];
+        for (int i = 0; i < ncore_; ++i)
+            sketch_[i].reset();
+    }
+    const size_t heap = heap_in_use();
+    sample_ = create_map_bucket_manager(ncore_, default_sample_hashtable_size, spare_sample_);
     run_phase(MAP, ncore_, total_sample_time_);
-    const size_t predicted_nkey = predict_nkey(e_, ncore_, nma);
+    const size_t sampled_heap = std::max(heap, heap_in_use()) - heap;
+    update_map_rate();
+    if (sketch_) {
+        find_hot_keys();
+        delete[] sketch_;
+        sketch_ = NULL;
+    }
+    const size_t predicted_nkey = predict_nkey(e_, ncore_, ntask);
     size_t predicted_ntask = predicted_nkey / expected_keys_per_bucket;
     predicted_ntask = std::max(predicted_ntask, size_t(ncore_) * min_group_or_reduce_task_per_core);
     predicted_ntask = std::min(predicted_ntask, size_t(ncore_) * max_group_or_reduce_task_per_core);
     ma_.trim(nma, true);
     sampling_ = false;
-    return prime_lower_bound(predicted_ntask);
+    const size_t nreduce_task = prime_lower_bound(predicted_ntask);
+    sample_done(predicted_nkey, nreduce_task, nsample_byte ? nsample_byte : nbyte, sampled_heap);
+    return nreduce_task;
 }
 
 int mapreduce_appbase::sched_run_no_final() {
@@ -208,10 +372,9 @@ int mapreduce_appbase::sched_run_no_final() {
     static_appbase::set_app(this);
     //assert(clean_);
     clean_ = false;
-    const int max_ncore = get_core_count();
-    assert(ncore_ <= max_ncore);
+    assert(ncore_ <= JOS_NCPU);
     if (!ncore_)
-	ncore_ = max_ncore;
+	ncore_ = cpumap_ncpu();
 
     verify_before_run();
     // initialize threads
@@ -227,20 +390,27 @@ int mapreduce_appbase::sched_run_no_final() {
     }
     uint64_t real_start = read_tsc();
     // get the number of reduce tasks by sampling if needed
+    hot_fanout_ = 0;
     if (skip_reduce_or_group_phase()) {
-        m_ = create_map_bucket_manager(ncore_, 1);
+        m_ = create_map_bucket_manager(ncore_, 1, spare_m_);
         get_reduce_bucket_manager()->init(ncore_);
     } else {
 	if (!nreduce_or_group_task_)
-	    nreduce_or_group_task_ = sched_sample();
-        m_ = create_map_bucket_manager(ncore_, nreduce_or_group_task_);
+	    nreduce_or_group_task_ = predict_reduce_tasks();
+        hot_fanout_ = std::min(std::min(ncore_, nreduce_or_group_task_), int(hot_key::max_fanout));
+        if (!nhot_ || hot_fanout_ < 2)
+            hot_fanout_ = 0;
+        m_ = create_map_bucket_manager(ncore_, nreduce_or_group_task_, spare_m_);
 	if (!get_reduce_bucket_manager()->get_init())
 	  get_reduce_bucket_manager()->init(nreduce_or_group_task_);
     }
 
     uint64_t map_time = 0, reduce_time = 0, merge_time = 0;
     // map phase
+    resize_map_tasks();
     run_phase(MAP, ncore_, map_time, nsample_);
+    update_map_rate();
+    map_done();
 
     //  re-emit in-store pre-reduced buckets
     xarray<keyval_t>* prb = static_cast<reduce_bucket_manager<keyval_t>*>(get_reduce_bucket_manager())->get(0);
@@ -249,24 +419,16 @@ int mapreduce_appbase::sched_run_no_final() {
     get_reduce_bucket_manager()->init(nreduce_or_group_task_);
     
     // reduce phase
-    if (!skip_reduce_or_group_phase())
+    if (!skip_reduce_or_group_phase()) {
+      plan_reduce_tasks();
       run_phase(REDUCE, ncore_, reduce_time);
-    // merge phase
-    const int use_psrs = USE_PSRS;
-    if (use_psrs) {
-        merge_ncore_ = ncore_;
-	run_phase(MERGE, merge_ncore_, merge_time);
-    } else {
-        reduce_bucket_manager_base *r = get_reduce_bucket_manager();
-	merge_ncore_ = std::min(int(r->size()) / 2, ncore_);
-	while (r->size() > 1) {
-	    run_phase(MERGE, merge_ncore_, merge_time);
-            r->trim(merge_ncore_);
-	    merge_ncore_ /= 2;
-	}
+      merge_hot_keys();
+      hot_homes_done();
     }
+    merge_phase(merge_time);
     //set_final_result();
     //std::cerr << "rb size=" << get_reduce_bucket_manager()->size() << std::endl;
+    release_map_buckets();
     total_map_time_ += map_time;
     total_reduce_time_ += reduce_time;
     total_merge_time_ += merge_time;
@@ -280,10 +442,9 @@ int mapreduce_appbase::sched_run() {
     static_appbase::set_app(this);
     //assert(clean_);
     clean_ = false;
-    const int max_ncore = get_core_count();
-    assert(ncore_ <= max_ncore);
+    assert(ncore_ <= JOS_NCPU);
     if (!ncore_)
-	ncore_ = max_ncore;
+	ncore_ = cpumap_ncpu();
 
     verify_before_run();
     // initialize threads
@@ -299,36 +460,33 @@ int mapreduce_appbase::sched_run() {
     }
     uint64_t real_start = read_tsc();
     // get the number of reduce tasks by sampling if needed
+    hot_fanout_ = 0;
     if (skip_reduce_or_group_phase()) {
-        m_ = create_map_bucket_manager(ncore_, 1);
+        m_ = create_map_bucket_manager(ncore_, 1, spare_m_);
         get_reduce_bucket_manager()->init(ncore_);
     } else {
 	if (!nreduce_or_group_task_)
-	    nreduce_or_group_task_ = sched_sample();
-        m_ = create_map_bucket_manager(ncore_, nreduce_or_group_task_);
+	    nreduce_or_group_task_ = predict_reduce_tasks();
+        hot_fanout_ = std::min(std::min(ncore_, nreduce_or_group_task_), int(hot_key::max_fanout));
+        if (!nhot_ || hot_fanout_ < 2)
+            hot_fanout_ = 0;
+        m_ = create_map_bucket_manager(ncore_, nreduce_or_group_task_, spare_m_);
         get_reduce_bucket_manager()->init(nreduce_or_group_task_);
     }
 
     uint64_t map_time = 0, reduce_time = 0, merge_time = 0;
     // map phase
+    resize_map_tasks();
     run_phase(MAP, ncore_, map_time, nsample_);
+    update_map_rate();
     // reduce phase
-    if (!skip_reduce_or_group_phase())
+    if (!skip_reduce_or_group_phase()) {
+        plan_reduce_tasks();
 	run_phase(REDUCE, ncore_, reduce_time);
-    // merge phase
-    const int use_psrs = USE_PSRS;
-    if (use_psrs) {
-        merge_ncore_ = ncore_;
-	run_phase(MERGE, merge_ncore_, merge_time);
-    } else {
-        reduce_bucket_manager_base *r = get_reduce_bucket_manager();
-	merge_ncore_ = std::min(int(r->size()) / 2, ncore_);
-	while (r->size() > 1) {
-	    run_phase(MERGE, merge_ncore_, merge_time);
-            r->trim(merge_ncore_);
-	    merge_ncore_ /= 2;
-	}
+        merge_hot_keys();
+        hot_homes_done();
     }
+    merge_phase(merge_time);
     set_final_result();
     total_map_time_ += map_time;
     total_reduce_time_ += reduce_time;
@@ -340,6 +498,7 @@ int mapreduce_appbase::sched_run() {
 
 void mapreduce_appbase::print_stats(void) {
     prof_print(ncore_);
+    cpumap_print(ncore_);
     uint64_t sum_time = total_sample_time_ + total_map_time_ + 
                         total_reduce_time_ + total_merge_time_;
 
@@ -358,16 +517,29 @@ void mapreduce_appbase::print_stats(void) {
     } else {
 	pprint("Sample:", nsample_, SEP);
 	pprint("Map:", ma_.size() - nsample_, SEP);
-	pprint("Reduce:", nreduce_or_group_task_, "\n");
+	pprint("Reduce:", nreduce_or_group_task_, nhot_ ? SEP : "\n");
+        if (nhot_)
+            pprint("Hot keys:", nhot_, "\n");
+    }
+    if (cycles_per_byte_) {
+        const uint64_t cycles_per_ms = get_cpu_freq() / 1000;
+        std::cout << "Map throughput per core\n\t";
+        pprint("KB/ms:", cycles_per_ms / cycles_per_byte_ / 1024, SEP);
+        pprint("Pairs/ms:", cycles_per_ms * pairs_per_cycle_, "\n");
     }
 }
 
 void mapreduce_appbase::map_emit(void *k, void *v, int keylen) {
     unsigned hash = partition(k, keylen);
     threadinfo *ti = threadinfo::current();
+    if (hot_fanout_ && !sampling_)
+        hash += hot_key_salt(k, keylen, hash, ti->cur_core_);
     bool newkey = (sampling_ ? sample_ : m_)->emit(ti->cur_core_, k, v, keylen, hash);
-    if (sampling_)
+    if (sampling_) {
         e_[ti->cur_core_].onepair(newkey);
+        if (sketch_)
+            sketch_[ti->cur_core_].add(k, keylen, hash);
+    }
 }
 
 void mapreduce_appbase::reduce_emit(void *k, void *v) {
@@ -378,16 +550,145 @@ void mapreduce_appbase::reduce_emit(void *k, void *v) {
     x->emit(keyval_t(k, v));
 }
 
-void mapreduce_appbase::reset() {
-    sampling_ = false;
+void mapreduce_appbase::update_map_rate() {
+    uint64_t bytes = 0, cycles = 0, pairs = 0;
+    for (int i = 0; i < ncore_; ++i) {
+        bytes += e_[i].bytes_;
+        cycles += e_[i].cycles_;
+        pairs += e_[i].pair_.current_;
+        e_[i].bytes_ = e_[i].cycles_ = 0;
+    }
+    if (!bytes || !cycles)
+        return;
+    const double cpb = double(cycles) / bytes;
+    cycles_per_byte_ = cycles_per_byte_ ? cycles_per_byte_ / 2 + cpb / 2 : cpb;
+    if (sampling_)
+        pairs_per_cycle_ = double(pairs) / cycles;
+}
+
+void mapreduce_appbase::resize_map_tasks() {
+    if (!cycles_per_byte_ || nsample_ >= ma_.size())
+        return;
+    size_t nbyte = 0;
+    for (size_t i = nsample_; i < ma_.size(); ++i)
+        nbyte += ma_[i].length;
+    static const uint64_t cycles_per_ms = get_cpu_freq() / 1000;
+    size_t ntask = nbyte * cycles_per_byte_ / (target_map_task_ms * cycles_per_ms);
+    ntask = std::max(ntask, size_t(ncore_) * min_map_task_per_core);
+    ntask = std::min(ntask, size_t(ncore_) * max_map_task_per_core);
+    if (!resize_splits(nsample_, (nbyte + ntask - 1) / ntask))
+        return;
+    ma_.trim(nsample_);
+    split_t ma;
+    bzero(&ma, sizeof(ma));
+    while (split(&ma, ncore_)) {
+        ma_.push_back(ma);
+        bzero(&ma, sizeof(ma));
+    }
+}
+
+void mapreduce_appbase::find_hot_keys() {
+    free_hot_keys();
+    typedef hotkey_sketch::entry entry;
+    uint64_t total = 0;
+    std::vector<entry *> e;
+    for (int i = 0; i < ncore_; ++i) {
+        total += sketch_[i].total_;
+        for (int j = 0; j < sketch_[i].n_; ++j)
+            e.push_back(&sketch_[i].e_[j]);
+    }
+    // add up the counts of a key seen by several workers
+    std::sort(e.begin(), e.end(), [](const entry *a, const entry *b) {
+            if (a->hash_ != b->hash_)
+                return a->hash_ < b->hash_;
+            if (a->len_ != b->len_)
+                return a->len_ < b->len_;
+            return memcmp(a->key_, b->key_, a->len_) < 0;
+        });
+    std::vector<std::pair<uint64_t, entry *> > hot;
+    for (size_t i = 0; i < e.size(); ) {
+        size_t j = i;
+        uint64_t count = 0;
+        for (; j < e.size() && e[j]->hash_ == e[i]->hash_ && e[j]->len_ == e[i]->len_ &&
+                   !memcmp(e[j]->key_, e[i]->key_, e[i]->len_); ++j)
+            count += e[j]->count_;
+        if (count >= min_hot_key_pairs && count * 2 * ncore_ >= total)
+            hot.push_back(std::make_pair(count, e[i]));
+        i = j;
+    }
+    std::sort(hot.begin(), hot.end(),
+              [](const std::pair<uint64_t, entry *> &a, const std::pair<uint64_t, entry *> &b) {
+                  return a.first > b.first;
+              });
+    for (size_t i = 0; i < hot.size() && nhot_ < max_hot_keys; ++i) {
+        const entry *x = hot[i].second;
+        hot_key &h = hot_[nhot_++];
+        h.hash_ = x->hash_;
+        h.len_ = x->len_;
+        h.key_ = safe_malloc<char>(x->len_ + 1);
+        memcpy(h.key_, x->key_, x->len_ + 1);
+        dprintf("hot key %s: %" PRIu64 " of %" PRIu64 " sampled pairs\n",
+                h.key_, hot[i].first, total);
+    }
+}
+
+unsigned mapreduce_appbase::hot_key_salt(void *k, int keylen, unsigned hash, int lcpu) {
+    for (int i = 0; i < nhot_; ++i) {
+        const hot_key &h = hot_[i];
+        if (h.hash_ == hash && h.len_ == keylen && !memcmp(h.key_, k, keylen))
+            return lcpu % hot_fanout_;
+    }
+    return 0;
+}
+
+hot_key::partial *mapreduce_appbase::hot_key_partial(const keyvals_t &p) {
+    if (!hot_fanout_)
+        return NULL;
+    const unsigned ncol = nreduce_or_group_task_;
+    const unsigned col = threadinfo::current()->cur_reduce_task_;
+    for (int i = 0; i < nhot_; ++i) {
+        hot_key &h = hot_[i];
+        const unsigned salt = (col + ncol - h.hash_ % ncol) % ncol;
+        if (salt < unsigned(hot_fanout_) && !key_compare(p.key_, h.key_))
+            return &h.part_[salt];
+    }
+    return NULL;
+}
+
+void mapreduce_appbase::free_hot_keys() {
+    for (int i = 0; i < nhot_; ++i) {
+        free(hot_[i].key_);
+        hot_[i].key_ = NULL;
+    }
+    nhot_ = 0;
+}
+
+size_t mapreduce_appbase::predict_reduce_tasks() {
+    if (reuse_sample_ && sampled_ntask_) {
+        nsample_ = 0;  // the map phase starts from the first split
+        return sampled_ntask_;
+    }
+    return sampled_ntask_ = sched_sample();
+}
+
+void mapreduce_appbase::release_map_buckets() {
     if (m_) {
-        delete m_;
+        m_->recycle();
+        delete spare_m_;
+        spare_m_ = m_;
         m_ = NULL;
     }
     if (sample_) {
-        delete sample_;
+        sample_->recycle();
+        delete spare_sample_;
+        spare_sample_ = sample_;
         sample_ = NULL;
     }
+}
+
+void mapreduce_appbase::reset() {
+    sampling_ = false;
+    release_map_buckets();
     bzero(e_, sizeof(e_));
     clean_ = true;
     nsample_ = 0;
@@ -396,6 +697,21 @@ void mapreduce_appbase::reset() {
 
 /** === map_reduce === */
 void map_reduce::internal_reduce_emit(keyvals_t &p) {
+    if (hot_key::partial *hp = hot_key_partial(p)) {
+        // reduced with the other columns' partials by merge_hot_keys
+        if (hp->key_)
+            key_free(p.key_);
+        else
+            hp->key_ = p.key_;
+        if (has_value_modifier()) {
+            hp->vals_.push_back(p.multiplex_value());
+            p.init();
+        } else {
+            hp->vals_.append(p);
+            p.trim(0);
+        }
+        return;
+    }
     if (has_value_modifier()) {
         assert(p.size() == 1);
         keyval_t x(p.key_, p.multiplex_value());
@@ -408,6 +724,48 @@ void map_reduce::internal_reduce_emit(keyvals_t &p) {
     }
 }
 
+void map_reduce::merge_hot_keys() {
+    for (int i = 0; i < nhot_; ++i) {
+        hot_key &h = hot_[i];
+        void *key = NULL;
+        xarray<void *> vals;
+        for (int s = 0; s < hot_key::max_fanout; ++s) {
+            hot_key::partial &hp = h.part_[s];
+            if (!hp.key_)
+                continue;
+            if (key)
+                key_free(hp.key_);
+            else
+                key = hp.key_;
+            vals.append(hp.vals_);
+            hp.vals_.trim(0);
+            hp.key_ = NULL;
+        }
+        if (!key)
+            continue;
+        const int home = h.hash_ % nreduce_or_group_task_;
+        rb_.set_current_reduce_task(home);
+        if (has_value_modifier()) {
+            void *v = vals[0];
+            for (size_t j = 1; j < vals.size(); ++j)
+                v = modify_function(v, vals[j]);
+            keyval_t x(key, v);
+            rb_.emit(x);
+            x.init();
+        } else
+            reduce_function(key, vals.array(), vals.size());
+        // keep the home column sorted by key for the merge phase
+        xarray<keyval_t> *b = rb_.get(home);
+        if (b->size() > 1) {
+            keyval_t x = b->back();
+            b->trim(b->size() - 1);
+            bool found;
+            b->insert(b->lower_bound(&x, static_appbase::key_comparator(), &found), &x);
+            x.init();
+        }
+    }
+}
+
 void map_reduce::map_values_insert(keyvals_t *kvs, void *v) {
     if (has_value_modifier()) {
         if (kvs->size() == 0)
@@ -430,6 +788,8 @@ void map_reduce::map_values_move(keyvals_t *dst, keyvals_t *src) {
         src->reset();
         return;
     }
+    if (src->size() == 0)
+        return;
     assert(src->multiplex());
     if (dst->size() == 0)
         dst->set_multiplex_value(src->multiplex_value());
@@ -50,7 +50,24 @@ struct app_impl_base : public mapreduce_appbase {
     void set_final_result() {
         rb_.transfer(0, &results_);
     }
+    /* @brief: optional function consuming the output of reduce task @task
+       as soon as it is complete, in the thread that ran it. Return true if
+       @out is consumed: its keys are then freed and it is left out of the
+       final results. */
+    virtual bool reduce_output(int task, xarray<T> *out) {
+        return false;
+    }
   protected:
+    void reduce_task_done(int task) {
+        xarray<T> *out = rb_.get(task);
+        if (!out->size() || !reduce_output(task, out))
+            return;
+        for (size_t i = 0; i < out->size(); ++i) {
+            this->key_free(out->at(i)->key_);
+            out->at(i)->reset();
+        }
+        out->trim(0);
+    }
     int internal_final_output_compare(const void *p1, const void *p2) {
         return final_output_compare((T *)p1, (T *)p2);
     }
@@ -113,6 +130,7 @@ struct map_reduce : public app_impl_base<keyval_t, atype_mapreduce> {
   protected:
     friend class static_appbase;
     void internal_reduce_emit(keyvals_t &p);
+    void merge_hot_keys();
     void map_values_insert(keyvals_t *kvs, void *val);
     void map_values_move(keyvals_t *dst, keyvals_t *src);
 };
@@ -0,0 +1,156 @@
+/* Metis
+ * Yandong Mao, Robert Morris, Frans Kaashoek
+ * Copyright (c) 2012 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, subject to the conditions listed
+ * in the Metis LICENSE file. These conditions include: you must preserve this
+ * copyright notice, and you cannot mention the copyright holders in
+ * advertising related to the Software without their permission.  The Software
+ * is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This notice is a
+ * summary of the Metis LICENSE file; the license in that file is legally
+ * binding.
+ */
+#include "cgroup.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+enum { cgroup_path_len = 512 };
+const char *cgroup_root = "/sys/fs/cgroup";
+
+/* Looks up the cgroup path of the current process for controller ctrl
+ * (the empty string selects the v2 unified hierarchy), and the name of
+ * the v1 hierarchy holding it (e.g. "cpu,cpuacct"). */
+bool self_cgroup(const char *ctrl, char *hier, char *path) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f)
+        return false;
+    char line[cgroup_path_len];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = 0;
+        char *ctrls = strchr(line, ':');
+        char *p = ctrls ? strchr(ctrls + 1, ':') : NULL;
+        if (!p)
+            continue;
+        *p++ = 0;
+        ++ctrls;
+        if (!*ctrl) {
+            found = !*ctrls;
+        } else {
+            size_t n = strlen(ctrl);
+            for (char *c = ctrls; c && !found; c = strchr(c, ',')) {
+                c += (*c == ',');
+                found = !strncmp(c, ctrl, n) && (c[n] == ',' || !c[n]);
+            }
+        }
+        if (found) {
+            strcpy(hier, ctrls);
+            strcpy(path, p);
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/* Opens a cgroup control file of the current process, as cgroup_read. */
+FILE *cgroup_open(const char *ctrl, const char *file) {
+    char hier[cgroup_path_len], path[cgroup_path_len];
+    char name[3 * cgroup_path_len];
+    FILE *f = NULL;
+    // cgroup v2. Inside a container the own path is usually not visible,
+    // and the namespace root is the cgroup itself.
+    if (self_cgroup("", hier, path)) {
+        snprintf(name, sizeof(name), "%s%s/%s", cgroup_root, path, file);
+        if ((f = fopen(name, "r")))
+            return f;
+        snprintf(name, sizeof(name), "%s/%s", cgroup_root, file);
+        if ((f = fopen(name, "r")))
+            return f;
+    }
+    // cgroup v1
+    if (self_cgroup(ctrl, hier, path)) {
+        snprintf(name, sizeof(name), "%s/%s%s/%s", cgroup_root, hier, path, file);
+        if ((f = fopen(name, "r")))
+            return f;
+        snprintf(name, sizeof(name), "%s/%s/%s", cgroup_root, hier, file);
+        if ((f = fopen(name, "r")))
+            return f;
+    }
+    return NULL;
+}
+
+/* Value of entry key of a "key value" control file such as memory.stat. */
+bool cgroup_stat(const char *ctrl, const char *file, const char *key, double *v) {
+    FILE *f = cgroup_open(ctrl, file);
+    if (!f)
+        return false;
+    char line[cgroup_path_len];
+    const size_t n = strlen(key);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f))
+        found = !strncmp(line, key, n) && line[n] == ' ' && sscanf(line + n, "%lf", v) == 1;
+    fclose(f);
+    return found;
+}
+
+}
+
+bool cgroup_read(const char *ctrl, const char *file, char *buf, int len) {
+    FILE *f = cgroup_open(ctrl, file);
+    if (!f)
+        return false;
+    bool ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    if (ok)
+        buf[strcspn(buf, "\n")] = 0;
+    return ok;
+}
+
+double cgroup_cpu_limit() {
+    char buf[128];
+    double quota = 0, period = 0;
+    if (cgroup_read("cpu", "cpu.max", buf, sizeof(buf))) {
+        // "max 100000" or "<quota> <period>"
+        if (sscanf(buf, "%lf %lf", &quota, &period) != 2)
+            return 0;
+    } else if (cgroup_read("cpu", "cpu.cfs_quota_us", buf, sizeof(buf))) {
+        quota = atof(buf);
+        if (cgroup_read("cpu", "cpu.cfs_period_us", buf, sizeof(buf)))
+            period = atof(buf);
+    }
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return quota / period;
+}
+
+size_t cgroup_memory_limit() {
+    char buf[128];
+    // "max" without a v2 limit, a page-rounded LONG_MAX without a v1 one
+    double limit = 0;
+    if (cgroup_read("memory", "memory.max", buf, sizeof(buf))
+        || cgroup_read("memory", "memory.limit_in_bytes", buf, sizeof(buf)))
+        limit = strcmp(buf, "max") ? atof(buf) : 0;
+    if (limit <= 0 || limit >= double(1ULL << 62))
+        return 0;
+    return size_t(limit);
+}
+
+size_t cgroup_memory_usage() {
+    char buf[128];
+    double usage = 0, inactive = 0;
+    if (cgroup_read("memory", "memory.current", buf, sizeof(buf))) {
+        usage = atof(buf);
+        cgroup_stat("memory", "memory.stat", "inactive_file", &inactive);
+    } else if (cgroup_read("memory", "memory.usage_in_bytes", buf, sizeof(buf))) {
+        usage = atof(buf);
+        cgroup_stat("memory", "memory.stat", "total_inactive_file", &inactive);
+    }
+    if (usage <= inactive)
+        return 0;
+    return size_t(usage - inactive);
+}
@@ -0,0 +1,37 @@
+/* Metis
+ * Yandong Mao, Robert Morris, Frans Kaashoek
+ * Copyright (c) 2012 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, subject to the conditions listed
+ * in the Metis LICENSE file. These conditions include: you must preserve this
+ * copyright notice, and you cannot mention the copyright holders in
+ * advertising related to the Software without their permission.  The Software
+ * is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This notice is a
+ * summary of the Metis LICENSE file; the license in that file is legally
+ * binding.
+ */
+#ifndef CGROUP_HH_
+#define CGROUP_HH_ 1
+#include <stddef.h>
+
+/* Reads the first line of a cgroup control file of the current process,
+ * trying cgroup v2 first, then the v1 hierarchy holding controller ctrl.
+ * Returns false if no such file is readable. */
+bool cgroup_read(const char *ctrl, const char *file, char *buf, int len);
+
+/* Number of cpus granted by the cpu bandwidth controller (cpu.max or
+ * cpu.cfs_quota_us / cpu.cfs_period_us), or 0 if there is no limit. */
+double cgroup_cpu_limit();
+
+/* Bytes granted by the memory controller (memory.max or
+ * memory.limit_in_bytes), or 0 if there is no limit. */
+size_t cgroup_memory_limit();
+
+/* Bytes charged to the memory cgroup that it cannot reclaim: its usage
+ * (memory.current or memory.usage_in_bytes) less its inactive file
+ * pages. 0 if unknown. */
+size_t cgroup_memory_usage();
+
+#endif
@@ -13,14 +13,151 @@
  * binding.
  */
 #include "cpumap.hh"
+#include "cgroup.hh"
+#include "bench.hh"
+#include <dirent.h>
+#if HAVE_LIBNUMA
+#include <numa.h>
+#endif
 
-static int logical_to_physical_[JOS_NCPU];
+namespace {
+
+struct cpuinfo_type {
+    int cpu_;
+    int node_;
+    int package_;
+    int core_;
+    int smt_;      // rank of the cpu among the hardware threads of its core
+    bool operator<(const cpuinfo_type &o) const {
+        if (smt_ != o.smt_)
+            return smt_ < o.smt_;
+        if (node_ != o.node_)
+            return node_ < o.node_;
+        if (package_ != o.package_)
+            return package_ < o.package_;
+        if (core_ != o.core_)
+            return core_ < o.core_;
+        return cpu_ < o.cpu_;
+    }
+};
+
+cpuinfo_type logical_to_physical_[JOS_NCPU];
+int nmapped_ = 0;      // cpus in the affinity mask
+int nusable_ = 0;      // nmapped_ capped by the cgroup quota
+double quota_ = 0;
+volatile bool pin_failed_ = false;
+
+int read_topology(int cpu, const char *file, int def) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return def;
+    int v = def;
+    if (fscanf(f, "%d", &v) != 1)
+        v = def;
+    fclose(f);
+    return v;
+}
+
+int read_node(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *d = opendir(path);
+    if (!d)
+        return 0;
+    int node = 0;
+    while (dirent *e = readdir(d))
+        if (sscanf(e->d_name, "node%d", &node) == 1)
+            break;
+    closedir(d);
+    return node;
+}
+
+}
 
 void cpumap_init() {
-    for (int i = 0; i < JOS_NCPU; ++i)
-	logical_to_physical_[i] = i;
+    if (nmapped_)
+        return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+        for (int i = 0; i < int(get_core_count()) && i < CPU_SETSIZE; ++i)
+            CPU_SET(i, &mask);
+    for (int c = 0; c < CPU_SETSIZE && nmapped_ < JOS_NCPU; ++c) {
+        if (!CPU_ISSET(c, &mask))
+            continue;
+        cpuinfo_type &ci = logical_to_physical_[nmapped_++];
+        ci.cpu_ = c;
+        ci.node_ = read_node(c);
+        ci.package_ = read_topology(c, "physical_package_id", 0);
+        ci.core_ = read_topology(c, "core_id", c);
+        ci.smt_ = 0;
+    }
+    assert(nmapped_ > 0);
+    // cpus are in increasing order: rank each among its core siblings
+    for (int i = 0; i < nmapped_; ++i)
+        for (int j = 0; j < i; ++j)
+            if (logical_to_physical_[j].package_ == logical_to_physical_[i].package_ &&
+                logical_to_physical_[j].core_ == logical_to_physical_[i].core_)
+                ++logical_to_physical_[i].smt_;
+    std::sort(logical_to_physical_, logical_to_physical_ + nmapped_);
+
+    nusable_ = nmapped_;
+    quota_ = cgroup_cpu_limit();
+    if (quota_ > 0)
+        nusable_ = std::max(1, std::min(nusable_, int(quota_)));
 }
 
 int cpumap_physical_cpuid(int i) {
-    return logical_to_physical_[i];
+    assert(nmapped_);
+    return logical_to_physical_[i % nmapped_].cpu_;
+}
+
+int cpumap_node(int i) {
+    assert(nmapped_);
+    return logical_to_physical_[i % nmapped_].node_;
+}
+
+int cpumap_ncpu() {
+    cpumap_init();
+    return nusable_;
+}
+
+bool cpumap_pin(int i) {
+#if HAVE_LIBNUMA
+    // allocations of the pinned thread (map buckets, reduce buckets) go
+    // to its own node rather than wherever first-touch happens to land
+    if (numa_available() != -1 && numa_max_node() > 0)
+        numa_set_preferred(cpumap_node(i));
+#endif
+    if (affinity_set(cpumap_physical_cpuid(i)) == 0)
+        return true;
+    pin_failed_ = true;
+    return false;
+}
+
+bool cpumap_pin_range(int first, int n) {
+    cpumap_init();
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int i = first; i < first + n; ++i)
+        CPU_SET(cpumap_physical_cpuid(i), &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == 0)
+        return true;
+    pin_failed_ = true;
+    return false;
+}
+
+void cpumap_print(int ncore) {
+    std::cout << "CPU placement [" << nusable_ << " of " << nmapped_ << " cpus";
+    if (quota_ > 0)
+        std::cout << ", cgroup quota " << quota_;
+    std::cout << (pin_failed_ ? ", unpinned" : "") << "]\n\t";
+    for (int i = 0; i < ncore; ++i) {
+        const cpuinfo_type &ci = logical_to_physical_[i % nmapped_];
+        std::cout << i << ":cpu" << ci.cpu_ << "/node" << ci.node_
+                  << (ci.smt_ ? "/smt" : "") << ((i + 1) % 8 ? " " : "\n\t");
+    }
+    std::cout << "\n";
 }
@@ -16,7 +16,24 @@
 #define CPUMAP_HH_ 1
 
 enum { main_core = 0 };
+/* Builds the logical to physical cpu map from the affinity mask of the
+ * process and the sysfs topology: distinct physical cores come first,
+ * grouped by NUMA node, then their SMT siblings. */
 void cpumap_init();
 int cpumap_physical_cpuid(int i);
+/* NUMA node of logical cpu i */
+int cpumap_node(int i);
+/* Number of logical cpus worth running workers on: the cpus of the
+ * affinity mask, capped by the cgroup cpu quota. */
+int cpumap_ncpu();
+/* Pins the calling thread to logical cpu i. Returns false if the
+ * affinity can not be set (e.g. denied inside a container); the thread
+ * then keeps running unpinned. */
+bool cpumap_pin(int i);
+/* Lets the calling thread run on logical cpus [first, first + n), the
+ * threads it creates inheriting them. Same result as cpumap_pin. */
+bool cpumap_pin_range(int first, int n);
+/* Prints the placement of the first ncore logical cpus */
+void cpumap_print(int ncore);
 
 #endif
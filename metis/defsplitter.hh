@@ -19,6 +19,8 @@
 #include <algorithm>
 #include <ctype.h>
 #include <iostream>
+#include <string>
+#include <vector>
 
 struct mmap_file {
     mmap_file(const char *f) {
@@ -27,12 +29,23 @@ struct mmap_file {
         assert(fstat(fd_, &fst) == 0);
         size_ = fst.st_size;
         d_ = (char *)mmap(0, size_ + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
-	assert(d_);
+	assert(d_ != MAP_FAILED);
+    }
+    /* @brief: maps the @len bytes of @f from offset @off, which need not
+       be page aligned, and asks the kernel to read them ahead */
+    mmap_file(const char *f, size_t off, size_t len) {
+        assert((fd_ = open(f, O_RDONLY)) >= 0);
+        delta_ = off % sysconf(_SC_PAGESIZE);
+        size_ = len;
+        char *base = (char *)mmap(0, delta_ + size_ + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, off - delta_);
+        assert(base != MAP_FAILED);
+        d_ = base + delta_;
+        madvise(base, delta_ + size_, MADV_WILLNEED);
     }
     mmap_file() : fd_(-1) {}
     virtual ~mmap_file() {
         if (fd_ >= 0) {
-            assert(munmap(d_, size_ + 1) == 0);
+            assert(munmap(d_ - delta_, delta_ + size_ + 1) == 0);
             assert(close(fd_) == 0);
         }
     }
@@ -43,65 +56,175 @@ struct mmap_file {
     char *d_;
   private:
     int fd_;
+    size_t delta_ = 0;  // offset of d_ in its first page
 };
 
+/* @brief: hands out splits over one buffer, or over one or several
+   mmapped files seen as a single split space. A split never crosses a
+   file boundary: split_t::file is the index of its input and
+   split_t::pos its offset in that input.
+
+   All boundaries are computed by the first call to split(), each one
+   found with memchr from its nominal offset; later calls only claim the
+   next precomputed split with an atomic increment. With an explicit
+   split count the input is cut evenly. Otherwise splits are
+   size_ / (ncores * def_nsplits_per_core) bytes, and once less than
+   2 * ncores such splits remain, the size follows guided
+   self-scheduling (remaining / (2 * ncores)) down to a 1/8 floor, so
+   the map phase does not end on a few large stragglers. resize() re-cuts
+   the splits not handed out yet around a new nominal size, e.g. one
+   derived from the throughput measured while sampling. */
 struct defsplitter {
     defsplitter(char *d, size_t size, size_t nsplit)
-        : d_(d), size_(size), nsplit_(nsplit), pos_(0) {
+        : nsplit_(nsplit) {
         pthread_mutex_init(&mu_, 0);
+        add_input(d, size, NULL);
     }
-    defsplitter(const char *f, size_t nsplit) : nsplit_(nsplit), pos_(0), mf_(f) {
+    defsplitter(const char *f, size_t nsplit) : nsplit_(nsplit) {
         pthread_mutex_init(&mu_, 0);
-        size_ = mf_.size_;
-        d_ = mf_.d_;
+        mmap_file *mf = new mmap_file(f);
+        add_input(mf->d_, mf->size_, mf);
+    }
+    defsplitter(const std::vector<std::string> &files, size_t nsplit)
+        : nsplit_(nsplit) {
+        pthread_mutex_init(&mu_, 0);
+        for (size_t i = 0; i < files.size(); ++i) {
+            mmap_file *mf = new mmap_file(files[i].c_str());
+            add_input(mf->d_, mf->size_, mf);
+        }
     }
   ~defsplitter()
   {
+      for (size_t i = 0; i < in_.size(); ++i)
+          delete in_[i].mf_;
   }
     int prefault() {
         int sum = 0;
-        for (size_t i = 0; i < size_; i += 4096)
-            sum += d_[i];
+        for (size_t f = 0; f < in_.size(); ++f)
+            for (size_t i = 0; i < in_[f].size_; i += 4096)
+                sum += in_[f].d_[i];
         return sum;
     }
   bool split(split_t *ma, int ncores, const char *stop, size_t align = 0) {
-    pthread_mutex_lock(&mu_);
-    if (pos_ >= size_) {
-	pthread_mutex_unlock(&mu_);
-	return false;
-    }
-    if (nsplit_ == 0)
-      nsplit_ = ncores * def_nsplits_per_core;
-    
-    ma->data = (void *) &d_[pos_];
-    ma->length = std::min(size_ - pos_, size_ / nsplit_);
-    ma->pos = pos_;
-    if (align) {
-        ma->length = round_down(ma->length, align);
-        assert(ma->length);
+    if (!__atomic_load_n(&planned_, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&mu_);
+        if (!planned_) {
+            plan(ncores, stop, align);
+            __atomic_store_n(&planned_, true, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&mu_);
     }
-
-    pos_ += ma->length;
-    for (; pos_ < size_ && stop && !strchr(stop, d_[pos_]); ++pos_, ++ma->length);
-
-    pthread_mutex_unlock(&mu_);
+    size_t i = __sync_fetch_and_add(&next_, 1);
+    if (i >= cuts_.size())
+        return false;
+    const cut &c = cuts_[i];
+    ma->data = (void *) &in_[c.file_].d_[c.pos_];
+    ma->length = c.length_;
+    ma->pos = c.pos_;
+    ma->file = c.file_;
     return true;
   };
   
+    /* @brief: re-cut the input after the first @first splits into splits
+       of about @nominal bytes, and hand them out from split @first on.
+       Returns false if the split count was fixed by the caller. Not safe
+       against concurrent split(). */
+    bool resize(size_t first, size_t nominal) {
+        if (!guided_ || !planned_ || first > cuts_.size())
+            return false;
+        size_t f = 0, pos = 0;
+        if (first) {
+            const cut &c = cuts_[first - 1];
+            f = c.file_;
+            pos = c.pos_ + c.length_;
+        }
+        cuts_.resize(first);
+        cut_from(f, pos, std::max(size_t(1), nominal));
+        next_ = first;
+        return true;
+    }
     void trim(size_t sz) {
-        assert(sz <= size_);
-        size_ = sz;
+        assert(in_.size() == 1 && sz <= in_[0].size_ && !planned_);
+        size_ = in_[0].size_ = sz;
     }
     size_t size() const {
         return size_;
     }
+    size_t ninput() const {
+        return in_.size();
+    }
 
   private:
-    char *d_;
-    size_t size_;
+    struct input {
+        char *d_;
+        size_t size_;
+        mmap_file *mf_;  // owned, NULL for a caller's buffer
+    };
+    struct cut {
+        size_t file_;
+        size_t pos_;
+        size_t length_;
+    };
+    void add_input(char *d, size_t size, mmap_file *mf) {
+        input in = {d, size, mf};
+        in_.push_back(in);
+        size_ += size;
+    }
+    /* @brief: offset of the first stop character at or after @pos */
+    static size_t find_stop(const input &in, size_t pos, const char *stop) {
+        if (!stop || pos >= in.size_)
+            return pos;
+        if (stop[0] && !stop[1]) {
+            const char *p = (const char *) memchr(&in.d_[pos], stop[0], in.size_ - pos);
+            return p ? p - in.d_ : in.size_;
+        }
+        for (; pos < in.size_ && !strchr(stop, in.d_[pos]); ++pos);
+        return pos;
+    }
+    void plan(int ncores, const char *stop, size_t align) {
+        guided_ = (nsplit_ == 0);
+        if (guided_)
+            nsplit_ = ncores * def_nsplits_per_core;
+        ncores_ = ncores;
+        stop_ = stop;
+        align_ = align;
+        cut_from(0, 0, std::max(size_t(1), size_ / nsplit_));
+    }
+    void cut_from(size_t f, size_t pos, size_t nominal) {
+        const size_t floor = std::max(size_t(1), nominal / 8);
+        const size_t tail = 2 * size_t(ncores_);
+        size_t remaining = f < in_.size() ? in_[f].size_ - pos : 0;
+        for (size_t i = f + 1; i < in_.size(); ++i)
+            remaining += in_[i].size_;
+        for (; f < in_.size(); ++f, pos = 0) {
+            const input &in = in_[f];
+            while (pos < in.size_) {
+                size_t len = nominal;
+                if (guided_ && remaining < tail * nominal)
+                    len = std::max(floor, remaining / tail);
+                len = std::min(in.size_ - pos, len);
+                if (align_) {
+                    len = round_down(len, align_);
+                    assert(len);
+                }
+                const size_t end = find_stop(in, pos + len, stop_);
+                cut c = {f, pos, end - pos};
+                cuts_.push_back(c);
+                remaining -= c.length_;
+                pos = end;
+            }
+        }
+    }
+    std::vector<input> in_;
+    std::vector<cut> cuts_;
+    size_t size_ = 0;  // total size of the inputs
     size_t nsplit_;
-    size_t pos_;
-    mmap_file mf_;
+    size_t next_ = 0;  // next split to hand out
+    bool planned_ = false;
+    bool guided_ = false;
+    int ncores_ = 1;
+    const char *stop_ = NULL;
+    size_t align_ = 0;
     pthread_mutex_t mu_;
 };
 
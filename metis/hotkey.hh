@@ -0,0 +1,85 @@
+/* Metis
+ * Yandong Mao, Robert Morris, Frans Kaashoek
+ * Copyright (c) 2012 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, subject to the conditions listed
+ * in the Metis LICENSE file. These conditions include: you must preserve this
+ * copyright notice, and you cannot mention the copyright holders in
+ * advertising related to the Software without their permission.  The Software
+ * is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This notice is a
+ * summary of the Metis LICENSE file; the license in that file is legally
+ * binding.
+ */
+#ifndef HOTKEY_HH_
+#define HOTKEY_HH_ 1
+
+#include <string.h>
+#include "mr-types.hh"
+#include "array.hh"
+
+/* @brief: SpaceSaving summary of the most frequent keys emitted by one
+   worker. A key missing from a full sketch replaces the entry with the
+   smallest count and inherits that count, so a count overestimates its
+   key by at most the smallest count. Keys longer than max_keylen are
+   counted in total_ only. */
+struct hotkey_sketch {
+    enum { nentry = 64, max_keylen = 128 };
+    struct entry {
+        uint64_t count_;
+        unsigned hash_;
+        int len_;
+        char key_[max_keylen + 1];
+    };
+    void reset() {
+        n_ = 0;
+        total_ = 0;
+    }
+    void add(const void *k, int keylen, unsigned hash) {
+        ++total_;
+        if (keylen > max_keylen)
+            return;
+        entry *min = NULL;
+        for (int i = 0; i < n_; ++i) {
+            entry &e = e_[i];
+            if (e.hash_ == hash && e.len_ == keylen && !memcmp(e.key_, k, keylen)) {
+                ++e.count_;
+                return;
+            }
+            if (!min || e.count_ < min->count_)
+                min = &e;
+        }
+        if (n_ < nentry) {
+            min = &e_[n_++];
+            min->count_ = 0;
+        }
+        ++min->count_;
+        min->hash_ = hash;
+        min->len_ = keylen;
+        memcpy(min->key_, k, keylen);
+        min->key_[keylen] = 0;
+    }
+    int n_;
+    uint64_t total_;
+    entry e_[nentry];
+};
+
+/* @brief: a key whose pairs are salted over several reduce columns:
+   emits from worker i go to column (hash_ + i % fanout) % ncol. The
+   reduce task of each column leaves its partial values in part_[salt],
+   and they are reduced together into the home column once the reduce
+   phase is over. */
+struct hot_key {
+    enum { max_fanout = 32 };
+    struct partial {
+        void *key_;
+        xarray<void *> vals_;
+    };
+    unsigned hash_;
+    int len_;
+    char *key_;
+    partial part_[max_fanout];
+};
+
+#endif
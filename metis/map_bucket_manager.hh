@@ -25,6 +25,9 @@ struct map_bucket_manager_base {
     virtual void global_init(size_t rows, size_t cols) = 0;
     virtual void per_worker_init(size_t row) = 0;
     virtual void reset(void) = 0;
+    /* @brief: empty the buckets but keep them allocated, so that a next
+       run with the same geometry skips global_init and per_worker_init */
+    virtual void recycle(void) = 0;
     virtual void rehash(size_t row, map_bucket_manager_base *backup) = 0;
     virtual bool emit(size_t row, void *key, void *val, size_t keylen,
 	              unsigned hash) = 0;
@@ -32,6 +35,8 @@ struct map_bucket_manager_base {
     virtual void do_reduce_task(size_t col) = 0;
     virtual size_t ncol() const = 0;
     virtual size_t nrow() const = 0;
+    /* number of keys the map worker of row emitted into column col */
+    virtual size_t bucket_size(size_t row, size_t col) = 0;
     virtual void psrs_output_and_reduce(size_t ncpus, size_t lcpu) = 0;
 };
 
@@ -85,9 +90,11 @@ struct map_insert_analyzer<DT, false> {
    and outputs pairs of OPT type. */
 template <bool S, typename DT, typename OPT>
 struct map_bucket_manager : public map_bucket_manager_base {
+    map_bucket_manager() : rows_(), cols_(), warm_() {}
     void global_init(size_t rows, size_t cols);
     void per_worker_init(size_t row);
     void reset(void);
+    void recycle(void);
     void rehash(size_t row, map_bucket_manager_base *backup);
     bool emit(size_t row, void *key, void *val, size_t keylen,
 	      unsigned hash);
@@ -99,6 +106,9 @@ struct map_bucket_manager : public map_bucket_manager_base {
     size_t ncol() const {
         return cols_;
     }
+    size_t bucket_size(size_t row, size_t col) {
+        return mapdt_bucket(row, col)->size();
+    }
     void psrs_output_and_reduce(size_t ncpus, size_t lcpu);
     typedef xarray<OPT> C;  // output bucket type
   private:
@@ -113,6 +123,7 @@ struct map_bucket_manager : public map_bucket_manager_base {
     size_t cols_;
     xarray<xarray<DT> *> mapdt_;  // intermediate ds holding key/value pairs at map phase
     xarray<C> output_;
+    bool warm_;  // buckets allocated by a previous run
 };
 
 template <bool S, typename DT, typename OPT>
@@ -143,6 +154,9 @@ void map_bucket_manager<S, DT, OPT>::psrs_output_and_reduce(size_t ncpus, size_t
 
 template <bool S, typename DT, typename OPT>
 void map_bucket_manager<S, DT, OPT>::global_init(size_t rows, size_t cols) {
+    if (warm_ && rows == rows_ && cols == cols_)
+        return;
+    reset();
     mapdt_.resize(rows);
     output_.resize(rows * cols);
     for (size_t i = 0; i < output_.size(); ++i)
@@ -153,6 +167,8 @@ void map_bucket_manager<S, DT, OPT>::global_init(size_t rows, size_t cols) {
 
 template <bool S, typename DT, typename OPT>
 void map_bucket_manager<S, DT, OPT>::per_worker_init(size_t row) {
+    if (warm_)
+        return;
     mapdt_[row] = safe_malloc<xarray<DT> >();
     mapdt_[row]->init();
     mapdt_[row]->resize(cols_);
@@ -172,6 +188,18 @@ void map_bucket_manager<S, DT, OPT>::reset() {
         free(mapdt_[i]);
     }
     mapdt_.shallow_free();
+    rows_ = cols_ = 0;
+    warm_ = false;
+}
+
+template <bool S, typename DT, typename OPT>
+void map_bucket_manager<S, DT, OPT>::recycle() {
+    for (size_t i = 0; i < output_.size(); ++i)
+        output_[i].shallow_free();
+    for (size_t i = 0; i < rows_; ++i)
+        for (size_t j = 0; j < cols_; ++j)
+            mapdt_bucket(i, j)->shallow_free();
+    warm_ = rows_ != 0;
 }
 
 template <bool S, typename DT, typename OPT>
@@ -24,7 +24,8 @@
 struct split_t {
     void *data;
     size_t length;
-    size_t pos;
+    size_t pos;   // offset of data in its input
+    size_t file;  // index of the input, for splitters over several files
 };
 
 struct keyval_t {
@@ -42,6 +42,8 @@ union __attribute__ ((__packed__, __aligned__(JOS_CLINE))) predictor {
         rate_predict key_;
         rate_predict pair_;
 	uint64_t n_;  // number of finished task
+        uint64_t bytes_;   // split bytes mapped
+        uint64_t cycles_;  // cycles spent mapping them
     };
     char __pad[2 * JOS_CLINE];
 
@@ -55,6 +57,10 @@ union __attribute__ ((__packed__, __aligned__(JOS_CLINE))) predictor {
         pair_.update_rate();
         ++n_;
     }
+    void task_timed(uint64_t bytes, uint64_t cycles) {
+        bytes_ += bytes;
+        cycles_ += cycles;
+    }
     void inc_predict(uint64_t *nk, uint64_t *np, int total_task) {
         uint64_t npi = pair_.predict(total_task - n_);
         *nk += key_.predict((npi - pair_.current_) / update_interval);
@@ -20,6 +20,7 @@
 #include "bsearch.hh"
 #include "mergesort.hh"
 #include "cpumap.hh"
+#include "spinpark.hh"
 
 template <typename C>
 struct psrs {
@@ -31,7 +32,6 @@ struct psrs {
         return (output_ = new C(output_size));
     }
     psrs() : lpairs_(JOS_NCPU), status_(STOP) {
-        bzero(ready_, sizeof(ready_));
         deinit();
     }
   private:
@@ -59,13 +59,11 @@ struct psrs {
     }
 
     enum { STOP, START };
-    union {
-        char __pad[JOS_CLINE];
-        volatile bool v;
-    } ready_[JOS_NCPU];
+    sr_barrier barrier_;
 
     pair_type pivots_[JOS_NCPU * (JOS_NCPU - 1)];
     C *output_;
+    int total_len_;
     int subsize_[JOS_NCPU * (JOS_NCPU + 1)];
     int partsize_[JOS_NCPU];
     xarray<C *> lpairs_;
@@ -74,28 +72,7 @@ struct psrs {
 
 template <typename C>
 void psrs<C>::cpu_barrier(int me, int ncore) {
-    if (me != main_core) {
-	while (status_ != START)
-            ;
-	ready_[me].v = true;
-	mfence();
-	while (status_ != STOP)
-            ;
-	ready_[me].v = false;
-    } else {
-	status_ = START;
-	mfence();
-	for (int i = 0; i < ncore; ++i)
-	    if (i != main_core)
-	        while (!ready_[i].v)
-                    ;
-	status_ = STOP;
-	mfence();
-	for (int i = 0; i < ncore; ++i)
-	    if (i != main_core)
-	        while (ready_[i].v)
-                    ;
-    }
+    barrier_.wait(ncore);
 }
 
 template <typename C> template <typename F>
@@ -177,12 +154,16 @@ C *psrs<C>::copy_elem(xarray<C> &a, int dst_start, int dst_end) {
  *          does not own the returned elements. */
 template <typename C> template <typename F>
 C *psrs<C>::do_psrs(xarray<C> &a, int ncpus, int me, F &pcmp) {
-    if (me == main_core)
+    // main core may deinit output_ as soon as the barrier is passed
+    // (small inputs), so read its size before
+    if (me == main_core) {
 	check_inited();
+        total_len_ = output_->size();
+    }
     cpu_barrier(me, ncpus);
 
     // get the [start, end] subarray
-    const int total_len = output_->size();
+    const int total_len = total_len_;
     const int w = (total_len + ncpus - 1) / ncpus;
     int start = w * me;
     int end = std::min(w * (me + 1), total_len) - 1;
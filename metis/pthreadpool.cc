@@ -17,40 +17,41 @@
 #include "bench.hh"
 #include "cpumap.hh"
 #include "threadinfo.hh"
+#include "spinpark.hh"
 #include <assert.h>
 #include <string.h>
 
+/* A pool thread spins for a short while waiting for its next task and
+   then parks, see spinpark.hh. state_ is the only word the main thread
+   and the worker synchronize on. */
 struct  __attribute__ ((aligned(JOS_CLINE))) athread_type {
+    enum { IDLE, PENDING, RUNNING };
     void *volatile a_;
     void *(*volatile f_) (void *);
-    volatile char pending_;
+    volatile int state_;
+    volatile int nparked_;
     pthread_t tid_;
-    volatile bool running_;
 
     template <typename T>
     void set_task(void *arg, T &f) {
         a_ = arg;
         f_ = f;
         mfence();
-        pending_ = true;
+        state_ = PENDING;
+        spin_park_wake(&state_, &nparked_);
     }
 
     void wait_finish() {
-        while (running_)
-            nop_pause();
+        spin_park_until(&state_, &nparked_, [](int s) { return s == IDLE; });
     }
 
-    void wait_running() {
-        while (pending_)
-            nop_pause();
-    }
     void run_next_task() {
-        while (!pending_)
-            nop_pause();
-        running_ = true;
-        pending_ = false;
+        spin_park_until(&state_, &nparked_, [](int s) { return s == PENDING; });
+        state_ = RUNNING;
         f_(a_);
-        running_ = false;
+        mfence();
+        state_ = IDLE;
+        spin_park_wake(&state_, &nparked_);
     }
 };
 
@@ -67,7 +68,7 @@ void *mthread_exit(void *) {
 void *mthread_entry(void *args) {
     threadinfo *ti = threadinfo::current();
     ti->cur_core_ = ptr2int<int>(args);
-    assert(affinity_set(cpumap_physical_cpuid(ti->cur_core_)) == 0);
+    cpumap_pin(ti->cur_core_);
     while (true)
         tp_[ti->cur_core_].run_next_task();
 }
@@ -82,7 +83,6 @@ void mthread_create(pthread_t * tid, int lid, void *(*start_routine) (void *),
     else {
         tp_[lid].wait_finish();
 	tp_[lid].set_task(arg, start_routine);
-        tp_[lid].wait_running();
     }
 }
 
@@ -92,21 +92,26 @@ void mthread_join(pthread_t tid, int lid, void **retval) {
 	*retval = 0;
 }
 
+/* The pool persists across Metis runs until mthread_finalize, and only
+   grows when a run asks for more cores than it holds. */
 void mthread_init(int ncore) {
-    if (tp_created_)
+    if (tp_created_ && ncore <= ncore_)
         return;
-    threadinfo *ti = threadinfo::current();
-    cpumap_init();
-    ncore_ = ncore;
-    ti->cur_core_ = main_core;
-    assert(affinity_set(cpumap_physical_cpuid(main_core)) == 0);
-    tp_created_ = true;
-    bzero(tp_, sizeof(tp_));
-    for (int i = 0; i < ncore_; ++i)
+    if (!tp_created_) {
+        threadinfo *ti = threadinfo::current();
+        cpumap_init();
+        ti->cur_core_ = main_core;
+        cpumap_pin(main_core);
+        tp_created_ = true;
+        bzero(tp_, sizeof(tp_));
+        ncore_ = 0;
+    }
+    for (int i = ncore_; i < ncore; ++i)
 	if (i == main_core)
 	    tp_[i].tid_ = pthread_self();
 	else
 	    assert(pthread_create(&tp_[i].tid_, NULL, mthread_entry, int2ptr(i)) == 0);
+    ncore_ = ncore;
 }
 
 void mthread_finalize(void) {
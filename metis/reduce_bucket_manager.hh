@@ -15,6 +15,7 @@
 #ifndef REDUCE_BUCKET_MANAGER_HH_
 #define REDUCE_BUCKET_MANAGER_HH_ 1
 
+#include <algorithm>
 #include "mr-types.hh"
 #include "psrs.hh"
 #include "appbase.hh"
@@ -27,7 +28,9 @@ struct reduce_bucket_manager_base {
     virtual void trim(size_t n) = 0;
     virtual size_t size() = 0;
     virtual void set_current_reduce_task(int i) = 0;
-    virtual void merge_reduced_buckets(int ncpus, int lcpu) = 0;
+    virtual void merge_reduced_buckets(int ncpus, int lcpu, bool presort) = 0;
+    virtual void sort_heads(int ncpus, int lcpu, size_t limit) = 0;
+    virtual void concat(size_t limit) = 0;
     //virtual int rb0_size() = 0;
     virtual bool get_init() const = 0;
 };
@@ -63,11 +66,15 @@ struct reduce_bucket_manager : public reduce_bucket_manager_base {
     }
     /** @brief: merge the output buckets of reduce phase, i.e. the final output.
         For psrs, the result is stored in rb_[0]; for mergesort, the result are
-        spread in rb[0..(ncpus - 1)]. */
-    void merge_reduced_buckets(int ncpus, int lcpu) {
+        spread in rb[0..(ncpus - 1)]. With @presort, the buckets are not
+        sorted by the final output order yet and mergesort sorts them first. */
+    void merge_reduced_buckets(int ncpus, int lcpu, bool presort) {
       C *out = NULL;
         const int use_psrs = USE_PSRS;
         if (!use_psrs) {
+            if (presort)
+                for (size_t i = lcpu; i < rb_.size(); i += ncpus)
+                    rb_[i].sort(static_appbase::final_output_pair_comp);
             out = mergesort(rb_, ncpus, lcpu,
                             static_appbase::final_output_pair_comp);
             shallow_free_subarray(rb_, lcpu, ncpus);
@@ -89,6 +96,42 @@ struct reduce_bucket_manager : public reduce_bucket_manager_base {
             delete out;
         }
     }
+    /** @brief: move the first @limit pairs of each of this cpu's buckets,
+        in the final output order, to the head of the bucket */
+    void sort_heads(int ncpus, int lcpu, size_t limit) {
+        for (size_t i = lcpu; i < rb_.size(); i += ncpus) {
+            T *a = rb_[i].array();
+            size_t n = rb_[i].size();
+            std::partial_sort(a, a + std::min(limit, n), a + n, output_less);
+        }
+    }
+    /** @brief: gather the buckets into rb_[0]. With @limit, the buckets'
+        heads come first and the first @limit pairs overall are sorted,
+        which holds once sort_heads has run: any of them is in the head of
+        its bucket. */
+    void concat(size_t limit) {
+        C *out = new C(sum_subarray(rb_));
+        size_t off = 0, nhead = 0;
+        for (int pass = (limit ? 0 : 1); pass < 2; ++pass)
+            for (size_t i = 0; i < rb_.size(); ++i) {
+                size_t n = rb_[i].size(), h = std::min(limit, n);
+                size_t first = pass ? h : 0, last = pass ? n : h;
+                if (last > first)
+                    rb_[i].copy(out->at(off), first, last - first);
+                off += last - first;
+                if (!pass)
+                    nhead += h;
+            }
+        assert(off == out->size());
+        if (limit) {
+            T *a = out->array();
+            std::partial_sort(a, a + std::min(limit, nhead), a + nhead, output_less);
+        }
+        shallow_free_subarray(rb_);
+        rb_[0].swap(*out);
+        delete out;
+        rb_.trim(1);
+    }
     void transfer(int p, C *dst) {
         assert(dst->size() == 0);
         get(p)->swap(*dst);
@@ -102,6 +145,9 @@ struct reduce_bucket_manager : public reduce_bucket_manager_base {
       return _init;
     }
   private:
+    static bool output_less(const T &p1, const T &p2) {
+        return static_appbase::final_output_pair_comp(&p1, &p2) < 0;
+    }
     int current_task() {
         return threadinfo::current()->cur_reduce_task_;
     }
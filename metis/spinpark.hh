@@ -0,0 +1,85 @@
+/* Metis
+ * Yandong Mao, Robert Morris, Frans Kaashoek
+ * Copyright (c) 2012 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, subject to the conditions listed
+ * in the Metis LICENSE file. These conditions include: you must preserve this
+ * copyright notice, and you cannot mention the copyright holders in
+ * advertising related to the Software without their permission.  The Software
+ * is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This notice is a
+ * summary of the Metis LICENSE file; the license in that file is legally
+ * binding.
+ */
+#ifndef SPINPARK_HH_
+#define SPINPARK_HH_ 1
+
+#include "bench.hh"
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Hybrid waiting: spin for about spin_cycles, which covers the gap
+   between two phases of a Metis run, then sleep on a futex so that idle
+   workers (e.g. between input files) do not burn their cpu. */
+enum { spin_cycles = 1 << 18 };
+
+inline void futex_wait(volatile int *w, int v) {
+    syscall(SYS_futex, (int *)w, FUTEX_WAIT_PRIVATE, v, NULL, NULL, 0);
+}
+
+inline void futex_wake_all(volatile int *w) {
+    syscall(SYS_futex, (int *)w, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* @brief: wait until done(*w) holds. *nparked counts the sleeping
+   waiters of w, so that spin_park_wake avoids the syscall when nobody
+   sleeps. */
+template <typename P>
+inline void spin_park_until(volatile int *w, volatile int *nparked, const P &done) {
+    uint64_t t0 = read_tsc();
+    while (!done(*w)) {
+        if (read_tsc() - t0 < spin_cycles) {
+            nop_pause();
+            continue;
+        }
+        __sync_fetch_and_add(nparked, 1);
+        int v = *w;
+        if (!done(v))
+            futex_wait(w, v);
+        __sync_fetch_and_sub(nparked, 1);
+    }
+}
+
+/* @brief: to be called after changing *w */
+inline void spin_park_wake(volatile int *w, volatile int *nparked) {
+    mfence();
+    if (*nparked)
+        futex_wake_all(w);
+}
+
+/* Sense-reversing barrier: each arrival is a single atomic increment;
+   the last one resets the count and flips the global sense the others
+   wait on. The sense to wait for is derived from the global one, so the
+   set of participants may change between uses. */
+struct sr_barrier {
+    sr_barrier() : count_(), sense_(), nparked_() {}
+    void wait(int n) {
+        const int sense = !sense_;
+        if (atomic_add32_ret((int *)&count_) == n - 1) {
+            count_ = 0;
+            mfence();
+            sense_ = sense;
+            spin_park_wake(&sense_, &nparked_);
+        } else
+            spin_park_until(&sense_, &nparked_, [sense](int s) { return s == sense; });
+    }
+  private:
+    volatile int count_;
+    char __pad[JOS_CLINE - sizeof(int)];
+    volatile int sense_;
+    volatile int nparked_;
+};
+
+#endif
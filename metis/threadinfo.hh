@@ -29,6 +29,8 @@ struct threadinfo {
         return ti;
     }
     static void initialize() {
+        if (created_)
+            return;
         assert(pthread_key_create(&key_, free) == 0);
         created_ = true;
     }
@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "checkpoint.h"
+#include "spill.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  namespace
+  {
+    const char magic[] = "MIWCKPT1";
+  }
+  
+  pid_t checkpoint::save(const std::string &fname, const std::function<bool(FILE*)> &write_records) const
+  {
+    pid_t pid = fork();
+    if (pid < 0)
+      {
+	LOG(ERROR) << "unable to fork the writer of checkpoint " << fname << ": " << strerror(errno);
+	return -1;
+      }
+    if (pid > 0)
+      return pid;
+
+    // child: only the forking thread is left, so no logging, and no exit
+    // handlers nor flush of the buffers inherited from the parent
+    std::string tmp = fname + ".tmp";
+    FILE *f = fopen(tmp.c_str(),"w");
+    if (!f)
+      _exit(1);
+    setvbuf(f,nullptr,_IOFBF,1<<20);
+    uint32_t len = _fname.length();
+    bool ok = fwrite(magic,1,8,f) == 8
+      && fwrite(&_file,sizeof(_file),1,f) == 1
+      && fwrite(&_offset,sizeof(_offset),1,f) == 1
+      && fwrite(&len,sizeof(len),1,f) == 1
+      && fwrite(_fname.data(),1,len,f) == len
+      && write_records(f);
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(),fname.c_str()) != 0)
+      {
+	unlink(tmp.c_str());
+	_exit(1);
+      }
+    _exit(0);
+  }
+
+  int checkpoint::wait(const pid_t &pid, const std::string &fname)
+  {
+    int status = 0;
+    if (waitpid(pid,&status,0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      {
+	LOG(ERROR) << "unable to write checkpoint " << fname;
+	return -1;
+      }
+    LOG(INFO) << "checkpoint saved in " << fname;
+    return 0;
+  }
+
+  int checkpoint::load(const std::string &fname, const std::function<void(log_record*)> &out)
+  {
+    FILE *f = fopen(fname.c_str(),"r");
+    if (!f)
+      {
+	LOG(ERROR) << "unable to open checkpoint " << fname << ": " << strerror(errno);
+	return -1;
+      }
+    setvbuf(f,nullptr,_IOFBF,1<<20);
+    char m[8];
+    uint32_t len = 0;
+    if (fread(m,1,8,f) != 8 || memcmp(m,magic,8) != 0
+	|| fread(&_file,sizeof(_file),1,f) != 1
+	|| fread(&_offset,sizeof(_offset),1,f) != 1
+	|| fread(&len,sizeof(len),1,f) != 1)
+      {
+	LOG(ERROR) << "not a miw checkpoint: " << fname;
+	fclose(f);
+	return -1;
+      }
+    _fname.resize(len);
+    int err = 0;
+    if (len && fread(&_fname[0],1,len,f) != len)
+      err = -1;
+    std::string buf;
+    while (err == 0)
+      {
+	log_record *lr = spill_runs::read_record(f,buf,err);
+	if (!lr)
+	  break;
+	out(lr);
+      }
+    fclose(f);
+    if (err < 0)
+      LOG(ERROR) << "truncated or malformed checkpoint " << fname;
+    return err;
+  }
+  
+}
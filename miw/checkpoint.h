@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "log_record.h"
+#include <string>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+namespace miw
+{
+  /**
+   * Checkpoint of the merged results of a job, written with -tmp_save and
+   * read back with -resume: the position in the input that the results
+   * cover, then the records in the binary form of the spilled runs, a key
+   * possibly having several records, merged again on resume.
+   *
+   * "MIWCKPT1" | int64 file index | uint64 offset | uint32 length, file name
+   * | records: uint32 length, log_record::serialize
+   */
+  class checkpoint
+  {
+  public:
+    checkpoint() {}
+    checkpoint(const int64_t &file, const uint64_t &offset, const std::string &fname)
+      :_file(file),_offset(offset),_fname(fname) {}
+
+    // writes the checkpoint to fname from a forked child, which sees the
+    // memory of the process as it is at the fork, copy-on-write, while
+    // the parent goes on. The child writes fname.tmp, then renames it to
+    // fname once complete. The records are written by write_records.
+    // Returns the pid of the child, -1 on error.
+    pid_t save(const std::string &fname, const std::function<bool(FILE*)> &write_records) const;
+
+    // waits for the child writing checkpoint fname. -1 if it failed.
+    static int wait(const pid_t &pid, const std::string &fname);
+
+    // reads the position, then calls out with every record, owned by
+    // out. -1 on error.
+    int load(const std::string &fname, const std::function<void(log_record*)> &out);
+
+    int64_t _file = -1; // index of the last input file of the results
+    uint64_t _offset = 0; // bytes of that file in the results
+    std::string _fname; // name of that file
+  };
+
+}
+
+#endif
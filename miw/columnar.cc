@@ -0,0 +1,499 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "columnar.h"
+#include "output_shards.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  static const char columnar_magic[] = "MIWCOL01";
+  static const size_t columnar_magic_len = 8;
+  
+  void columnar_group::begin()
+  {
+    // drops the values of an unfinished row
+    for (size_t i=0;i<_touched.size();i++)
+      {
+	column &c = _columns[_touched[i]];
+	if (c._kinds.size() > _rows)
+	  {
+	    c._cells.resize(c._starts.back());
+	    c._kinds.pop_back();
+	    c._starts.pop_back();
+	  }
+      }
+    _touched.clear();
+    _col = nullptr;
+    _hint = 0;
+    _in_array = false;
+  }
+
+  void columnar_group::key(const std::string &k)
+  {
+    size_t i = _hint;
+    if (i >= _columns.size() || _columns[i]._name != k)
+      {
+	std::unordered_map<std::string,size_t>::const_iterator hit;
+	if ((hit=_index.find(k))!=_index.end())
+	  i = (*hit).second;
+	else
+	  {
+	    i = _columns.size();
+	    _index.insert(std::pair<std::string,size_t>(k,i));
+	    _columns.push_back(column());
+	    _columns.back()._name = k;
+	  }
+      }
+    _hint = i + 1;
+    column &c = _columns[i];
+    if (c._kinds.size() > _rows)
+      {
+	// the last value of a key wins
+	c._cells.resize(c._starts.back());
+	c._kinds.pop_back();
+	c._starts.pop_back();
+      }
+    else _touched.push_back(i);
+    c._kinds.resize(_rows,r_null);
+    c._starts.resize(_rows,c._cells.size());
+    c._kinds.push_back(r_null);
+    c._starts.push_back(c._cells.size());
+    _col = &c;
+  }
+
+  void columnar_group::push(const cell &c)
+  {
+    _col->_cells.push_back(c);
+    if (!_in_array)
+      _col->_kinds.back() = r_scalar;
+  }
+  
+  void columnar_group::value_null()
+  {
+    if (_in_array)
+      push(cell{c_null,0,0.0});
+  }
+
+  void columnar_group::value_int(const long long &v)
+  {
+    push(cell{c_int,v,0.0});
+  }
+
+  void columnar_group::value_uint(const unsigned long long &v)
+  {
+    push(cell{c_int,static_cast<int64_t>(v),0.0});
+  }
+
+  void columnar_group::value_double(const double &v)
+  {
+    push(cell{c_double,0,v});
+  }
+
+  void columnar_group::value_bool(const bool &v)
+  {
+    push(cell{c_bool,v ? 1 : 0,0.0});
+  }
+
+  void columnar_group::value_string(const std::string &v)
+  {
+    uint32_t code = _col->_dict.insert(std::pair<std::string,uint32_t>(v,_col->_dict.size())).first->second;
+    push(cell{c_string,code,0.0});
+  }
+
+  void columnar_group::begin_array()
+  {
+    _col->_kinds.back() = r_union;
+    _in_array = true;
+  }
+
+  void columnar_group::end_array()
+  {
+    _in_array = false;
+  }
+
+  void columnar_group::end(std::string&)
+  {
+    ++_rows;
+    _touched.clear();
+    _col = nullptr;
+    _hint = 0;
+  }
+
+  void columnar_group::append_buffer(std::string &data, Json::Value &buf,
+				     const void *p, const size_t &len)
+  {
+    data.append((8 - data.length() % 8) % 8,'\0');
+    buf = Json::Value(Json::arrayValue);
+    buf.append(static_cast<Json::UInt64>(data.length()));
+    buf.append(static_cast<Json::UInt64>(len));
+    data.append(static_cast<const char*>(p),len);
+  }
+  
+  void columnar_group::encode(std::string &data, Json::Value &meta)
+  {
+    meta = Json::Value(Json::objectValue);
+    meta["num_rows"] = static_cast<Json::UInt64>(_rows);
+    Json::Value &jcols = meta["columns"];
+    jcols = Json::Value(Json::objectValue);
+    for (size_t ci=0;ci<_columns.size();ci++)
+      {
+	column &c = _columns[ci];
+	c._kinds.resize(_rows,r_null);
+	c._starts.resize(_rows,c._cells.size());
+	bool has_union = false, has_string = false, has_double = false, has_int = false, has_bool = false;
+	size_t nulls = 0;
+	for (size_t r=0;r<_rows;r++)
+	  {
+	    if (c._kinds[r] == r_union)
+	      has_union = true;
+	    else if (c._kinds[r] == r_null)
+	      ++nulls;
+	  }
+	for (size_t j=0;j<c._cells.size();j++)
+	  {
+	    int t = c._cells[j]._type;
+	    has_string |= t == c_string;
+	    has_double |= t == c_double;
+	    has_int |= t == c_int;
+	    has_bool |= t == c_bool;
+	  }
+	std::string type = has_string ? "string" : has_double ? "float64"
+	  : has_int ? "int64" : has_bool ? "bool" : "null";
+	Json::Value &jc = jcols[c._name];
+	jc["type"] = type;
+	jc["union"] = has_union;
+	jc["nulls"] = static_cast<Json::UInt64>(nulls);
+	if (type == "null")
+	  continue;
+
+	if (nulls > 0)
+	  {
+	    std::vector<uint8_t> validity((_rows + 7) / 8,0);
+	    for (size_t r=0;r<_rows;r++)
+	      if (c._kinds[r] != r_null)
+		validity[r >> 3] |= 1 << (r & 7);
+	    append_buffer(data,jc["validity"],validity.data(),validity.size());
+	  }
+
+	// cells of the values, in row order
+	static const cell null_cell = { c_null, 0, 0.0 };
+	std::vector<const cell*> vals;
+	std::vector<uint32_t> offsets;
+	vals.reserve(c._cells.size() + nulls);
+	for (size_t r=0;r<_rows;r++)
+	  {
+	    size_t s = c._starts[r], e = r + 1 < _rows ? c._starts[r+1] : c._cells.size();
+	    if (has_union)
+	      {
+		offsets.push_back(vals.size());
+		for (size_t j=s;j<e;j++)
+		  vals.push_back(&c._cells[j]);
+	      }
+	    else vals.push_back(c._kinds[r] == r_scalar ? &c._cells[s] : &null_cell);
+	  }
+	if (has_union)
+	  {
+	    offsets.push_back(vals.size());
+	    append_buffer(data,jc["offsets"],offsets.data(),offsets.size() * sizeof(uint32_t));
+	  }
+
+	if (type == "int64")
+	  {
+	    std::vector<int64_t> v(vals.size(),0);
+	    int64_t vmin = std::numeric_limits<int64_t>::max(), vmax = std::numeric_limits<int64_t>::min();
+	    for (size_t j=0;j<vals.size();j++)
+	      if (vals[j]->_type != c_null)
+		{
+		  v[j] = vals[j]->_i;
+		  vmin = std::min(vmin,v[j]);
+		  vmax = std::max(vmax,v[j]);
+		}
+	    append_buffer(data,jc["values"],v.data(),v.size() * sizeof(int64_t));
+	    if (vmin <= vmax)
+	      {
+		jc["min"] = static_cast<Json::Int64>(vmin);
+		jc["max"] = static_cast<Json::Int64>(vmax);
+	      }
+	  }
+	else if (type == "float64")
+	  {
+	    std::vector<double> v(vals.size(),std::numeric_limits<double>::quiet_NaN());
+	    double vmin = std::numeric_limits<double>::infinity(), vmax = -vmin;
+	    for (size_t j=0;j<vals.size();j++)
+	      if (vals[j]->_type != c_null)
+		{
+		  v[j] = vals[j]->_type == c_double ? vals[j]->_d : static_cast<double>(vals[j]->_i);
+		  vmin = std::min(vmin,v[j]);
+		  vmax = std::max(vmax,v[j]);
+		}
+	    append_buffer(data,jc["values"],v.data(),v.size() * sizeof(double));
+	    if (vmin <= vmax)
+	      {
+		jc["min"] = vmin;
+		jc["max"] = vmax;
+	      }
+	  }
+	else if (type == "bool")
+	  {
+	    std::vector<uint8_t> v(vals.size(),0);
+	    for (size_t j=0;j<vals.size();j++)
+	      v[j] = vals[j]->_i != 0;
+	    append_buffer(data,jc["values"],v.data(),v.size());
+	  }
+	else
+	  {
+	    // numbers mixed with strings are stored as their text
+	    std::vector<uint32_t> v(vals.size(),0);
+	    for (size_t j=0;j<vals.size();j++)
+	      {
+		const cell &x = *vals[j];
+		if (x._type == c_string)
+		  v[j] = x._i;
+		else if (x._type != c_null)
+		  {
+		    std::string text;
+		    if (x._type == c_double)
+		      json_writer::append_double(text,x._d);
+		    else append_int(text,x._i);
+		    v[j] = c._dict.insert(std::pair<std::string,uint32_t>(text,c._dict.size())).first->second;
+		  }
+	      }
+	    std::vector<const std::string*> dict(c._dict.size(),nullptr);
+	    for (auto dit = c._dict.begin();dit!=c._dict.end();++dit)
+	      dict[(*dit).second] = &(*dit).first;
+	    std::vector<uint32_t> doffsets(1,0);
+	    std::string dvalues;
+	    for (size_t j=0;j<dict.size();j++)
+	      {
+		dvalues += *dict[j];
+		doffsets.push_back(dvalues.length());
+	      }
+	    append_buffer(data,jc["values"],v.data(),v.size() * sizeof(uint32_t));
+	    append_buffer(data,jc["dict_offsets"],doffsets.data(),doffsets.size() * sizeof(uint32_t));
+	    append_buffer(data,jc["dict_values"],dvalues.data(),dvalues.length());
+	    jc["distinct"] = static_cast<Json::UInt64>(dict.size());
+	  }
+      }
+    data.append((8 - data.length() % 8) % 8,'\0');
+  }
+
+  columnar_file::~columnar_file()
+  {
+    close();
+  }
+
+  int columnar_file::open(const std::string &ofname)
+  {
+    close();
+    _fd = ::open(ofname.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if (_fd < 0)
+      {
+	LOG(ERROR) << "unable to open output file=" << ofname << ": " << strerror(errno);
+	return -1;
+      }
+    output_shards::pwrite_all(_fd,columnar_magic,columnar_magic_len,0);
+    _off = columnar_magic_len;
+    _outputs = 0;
+    return 0;
+  }
+
+  void columnar_file::write(const uint64_t &key, columnar_group &g)
+  {
+    if (g.rows() == 0)
+      return;
+    std::string data;
+    Json::Value meta;
+    g.encode(data,meta);
+    off_t off = _off.fetch_add(data.length());
+    output_shards::pwrite_all(_fd,data.data(),data.length(),off);
+    meta["offset"] = static_cast<Json::UInt64>(off);
+    meta["length"] = static_cast<Json::UInt64>(data.length());
+    std::lock_guard<std::mutex> lock(_groups_mutex);
+    _groups.push_back(std::pair<uint64_t,Json::Value>(key,meta));
+  }
+
+  int columnar_file::close()
+  {
+    if (_fd < 0)
+      return 0;
+    std::sort(_groups.begin(),_groups.end(),
+	      [](const std::pair<uint64_t,Json::Value> &g1, const std::pair<uint64_t,Json::Value> &g2)
+	      { return g1.first < g2.first; });
+    Json::Value footer;
+    footer["format"] = "miw-columnar";
+    footer["version"] = 1;
+    Json::UInt64 rows = 0;
+    std::set<std::string> names;
+    Json::Value &jgroups = footer["row_groups"];
+    jgroups = Json::Value(Json::arrayValue);
+    for (size_t i=0;i<_groups.size();i++)
+      {
+	rows += _groups[i].second["num_rows"].asUInt64();
+	for (const std::string &n : _groups[i].second["columns"].getMemberNames())
+	  names.insert(n);
+	jgroups.append(_groups[i].second);
+      }
+    footer["num_rows"] = rows;
+    Json::Value &jnames = footer["columns"];
+    jnames = Json::Value(Json::arrayValue);
+    for (const std::string &n : names)
+      jnames.append(n);
+    Json::FastWriter writer;
+    std::string tail = writer.write(footer);
+    uint64_t flen = tail.length();
+    tail.append(reinterpret_cast<const char*>(&flen),sizeof(flen));
+    tail.append(columnar_magic,columnar_magic_len);
+    output_shards::pwrite_all(_fd,tail.data(),tail.length(),_off);
+    int err = ::close(_fd);
+    _fd = -1;
+    _groups.clear();
+    if (err < 0)
+      {
+	LOG(ERROR) << "error closing columnar output: " << strerror(errno);
+	return -1;
+      }
+    return 0;
+  }
+
+  columnar_reader::~columnar_reader()
+  {
+    close();
+  }
+
+  int columnar_reader::open(const std::string &fname)
+  {
+    close();
+    _fd = ::open(fname.c_str(),O_RDONLY);
+    struct stat st;
+    if (_fd < 0 || fstat(_fd,&st) != 0)
+      {
+	LOG(ERROR) << "unable to open columnar file=" << fname << ": " << strerror(errno);
+	close();
+	return -1;
+      }
+    _size = st.st_size;
+    const size_t trailer = sizeof(uint64_t) + columnar_magic_len;
+    if (_size >= columnar_magic_len + trailer)
+      {
+	void *p = mmap(nullptr,_size,PROT_READ,MAP_SHARED,_fd,0);
+	if (p != MAP_FAILED)
+	  _data = static_cast<const char*>(p);
+      }
+    uint64_t flen = 0;
+    if (_data)
+      memcpy(&flen,_data + _size - trailer,sizeof(flen));
+    if (!_data || memcmp(_data,columnar_magic,columnar_magic_len)
+	|| memcmp(_data + _size - columnar_magic_len,columnar_magic,columnar_magic_len)
+	|| flen > _size - columnar_magic_len - trailer)
+      {
+	LOG(ERROR) << "not a columnar file: " << fname;
+	close();
+	return -1;
+      }
+    const char *f = _data + _size - trailer - flen;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    std::string errs;
+    if (!reader->parse(f,f + flen,&_footer,&errs))
+      {
+	LOG(ERROR) << "error reading the footer of columnar file " << fname << ": " << errs;
+	close();
+	return -1;
+      }
+    return 0;
+  }
+
+  void columnar_reader::close()
+  {
+    if (_data)
+      munmap(const_cast<char*>(_data),_size);
+    if (_fd >= 0)
+      ::close(_fd);
+    _data = nullptr;
+    _fd = -1;
+    _size = 0;
+    _footer = Json::Value();
+  }
+
+  bool columnar_reader::column(const size_t &g, const std::string &name, column_view &v) const
+  {
+    if (g >= groups())
+      return false;
+    const Json::Value &jg = _footer["row_groups"][static_cast<Json::ArrayIndex>(g)];
+    if (!jg["columns"].isMember(name))
+      return false;
+    const Json::Value &jc = jg["columns"][name];
+    const size_t goff = jg["offset"].asUInt64(), glen = jg["length"].asUInt64();
+    if (goff + glen > _size)
+      return false;
+    v = column_view();
+    v._type = jc["type"].asString();
+    v._union = jc["union"].asBool();
+    v._rows = jg["num_rows"].asUInt64();
+    bool ok = true;
+    auto buffer = [&](const char *b, size_t &len) -> const char*
+      {
+	len = 0;
+	const Json::Value &jb = jc[b];
+	if (!jb.isArray() || jb.size() != 2)
+	  return nullptr;
+	size_t off = jb[0].asUInt64();
+	len = jb[1].asUInt64();
+	if (off + len > glen)
+	  {
+	    ok = false;
+	    len = 0;
+	    return nullptr;
+	  }
+	return _data + goff + off;
+      };
+    size_t len = 0;
+    v._validity = reinterpret_cast<const uint8_t*>(buffer("validity",len));
+    v._offsets = reinterpret_cast<const uint32_t*>(buffer("offsets",len));
+    v._values = buffer("values",len);
+    size_t width = v._type == "bool" ? 1 : v._type == "string" ? sizeof(uint32_t) : sizeof(int64_t);
+    v._nvalues = len / width;
+    v._dict_offsets = reinterpret_cast<const uint32_t*>(buffer("dict_offsets",len));
+    v._dict_size = len ? len / sizeof(uint32_t) - 1 : 0;
+    v._dict_values = buffer("dict_values",len);
+    return ok;
+  }
+  
+}
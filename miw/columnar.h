@@ -0,0 +1,209 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include "record_writer.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include <sys/types.h>
+#include <jsoncpp/json/json.h>
+
+namespace miw
+{
+  /**
+   * Columnar binary output. A file is a sequence of row groups followed
+   * by a JSON footer:
+   *
+   *   "MIWCOL01" | row group | ... | footer | footer length (uint64) | "MIWCOL01"
+   *
+   * A row group holds a chunk per column, made of 8-byte aligned buffers:
+   * a validity bitmap (bit set for non-null rows, only when the column has
+   * nulls), uint32 row offsets into the values for union columns, and the
+   * values: int64, float64, uint8 for bool, or uint32 codes into a
+   * dictionary of strings (uint32 offsets and bytes) local to the group.
+   * The footer lists the row groups in output order, with the type,
+   * buffers (offset and length from the start of the group) and stats of
+   * every column. Numbers are in the byte order of the writing host.
+   */
+  class columnar_group : public record_writer
+  {
+  public:
+    void begin();
+    void key(const std::string &k);
+    void value_null();
+    void value_int(const long long &v);
+    void value_uint(const unsigned long long &v);
+    void value_double(const double &v);
+    void value_bool(const bool &v);
+    void value_string(const std::string &v);
+    void begin_array();
+    void end_array();
+
+    // closes the row, which stays in the group: out is left as is.
+    void end(std::string &out);
+
+    size_t rows() const { return _rows; }
+
+    // drops all the rows.
+    void clear() { *this = columnar_group(); }
+
+    // buffers of the group in data, and their layout in meta.
+    void encode(std::string &data, Json::Value &meta);
+
+  private:
+    enum { c_null, c_int, c_double, c_bool, c_string };
+    enum { r_null, r_scalar, r_union };
+    struct cell
+    {
+      int _type;
+      int64_t _i; /**< int, bool, or dictionary code */
+      double _d;
+    };
+    struct column
+    {
+      std::string _name;
+      std::vector<uint8_t> _kinds; /**< per row, up to the last one set */
+      std::vector<uint32_t> _starts; /**< first cell of each row */
+      std::vector<cell> _cells;
+      std::unordered_map<std::string,uint32_t> _dict;
+    };
+
+    void push(const cell &c);
+    static void append_buffer(std::string &data, Json::Value &buf,
+			      const void *p, const size_t &len);
+
+    std::vector<column> _columns;
+    std::unordered_map<std::string,size_t> _index; /**< column of each key */
+    size_t _hint = 0; /**< next column, keys coming in the same order in every row */
+    column *_col = nullptr; /**< column of the current key */
+    std::vector<size_t> _touched; /**< columns set in the current row */
+    size_t _rows = 0;
+  };
+
+  /**
+   * Columnar output file, its row groups being written concurrently at
+   * offsets reserved atomically. Groups are listed in the footer by
+   * increasing key, next_output() giving the first key of a new output.
+   */
+  class columnar_file
+  {
+  public:
+    columnar_file() {}
+    ~columnar_file();
+
+    int open(const std::string &ofname);
+
+    // writes the footer and closes the file.
+    int close();
+
+    bool is_open() const { return _fd >= 0; }
+
+    uint64_t next_output() { return _outputs.fetch_add(1) << 32; }
+    
+    void write(const uint64_t &key, columnar_group &g);
+
+  private:
+    int _fd = -1;
+    std::atomic<off_t> _off{0};
+    std::atomic<uint64_t> _outputs{0};
+    std::mutex _groups_mutex;
+    std::vector<std::pair<uint64_t,Json::Value>> _groups;
+  };
+
+  /**
+   * View of a column in a row group, pointing into the mapped file.
+   */
+  struct column_view
+  {
+    std::string _type; /**< int64, float64, bool, string or null (all rows null) */
+    bool _union = false;
+    size_t _rows = 0;
+    const uint8_t *_validity = nullptr;
+    const uint32_t *_offsets = nullptr; /**< unions: rows + 1 offsets into the values */
+    const void *_values = nullptr;
+    size_t _nvalues = 0;
+    const uint32_t *_dict_offsets = nullptr;
+    const char *_dict_values = nullptr;
+    size_t _dict_size = 0;
+
+    bool is_null(const size_t &r) const
+    {
+      return _type == "null" || (_validity && !(_validity[r >> 3] & (1 << (r & 7))));
+    }
+
+    // values of row r: [first(r),last(r)), a single value for scalar columns.
+    size_t first(const size_t &r) const { return _offsets ? _offsets[r] : r; }
+    size_t last(const size_t &r) const { return _offsets ? _offsets[r+1] : r + 1; }
+
+    int64_t int64(const size_t &i) const { return static_cast<const int64_t*>(_values)[i]; }
+    double float64(const size_t &i) const { return static_cast<const double*>(_values)[i]; }
+    bool boolean(const size_t &i) const { return static_cast<const uint8_t*>(_values)[i] != 0; }
+    uint32_t code(const size_t &i) const { return static_cast<const uint32_t*>(_values)[i]; }
+    std::string dict(const uint32_t &c) const
+    {
+      return std::string(_dict_values + _dict_offsets[c],_dict_offsets[c+1] - _dict_offsets[c]);
+    }
+    std::string str(const size_t &i) const { return dict(code(i)); }
+  };
+
+  /**
+   * Memory-mapped reader of a columnar file.
+   */
+  class columnar_reader
+  {
+  public:
+    columnar_reader() {}
+    ~columnar_reader();
+
+    int open(const std::string &fname);
+    void close();
+
+    size_t rows() const { return _footer["num_rows"].asUInt64(); }
+    size_t groups() const { return _footer["row_groups"].size(); }
+    size_t rows(const size_t &g) const { return _footer["row_groups"][(int)g]["num_rows"].asUInt64(); }
+    const Json::Value& footer() const { return _footer; }
+
+    // view of column name in group g, false if no row of the group has it.
+    bool column(const size_t &g, const std::string &name, column_view &v) const;
+
+  private:
+    int _fd = -1;
+    const char *_data = nullptr;
+    size_t _size = 0;
+    Json::Value _footer;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,454 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "compressed_input.h"
+#include "cpumap.hh"
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+#ifdef HAVE_SNAPPY_H
+#include <snappy.h>
+#endif
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  compressed_input::codec compressed_input::detect(const std::string &fname)
+  {
+    unsigned char h[10];
+    int fd = ::open(fname.c_str(),O_RDONLY);
+    if (fd < 0)
+      return none;
+    ssize_t n = read(fd,h,sizeof(h));
+    ::close(fd);
+    if (n >= 2 && h[0] == 0x1f && h[1] == 0x8b)
+      return gzip;
+    if (n >= 4 && h[0] == 0x28 && h[1] == 0xb5 && h[2] == 0x2f && h[3] == 0xfd)
+      return zstd;
+    if (n >= 4 && (h[0] & 0xf0) == 0x50 && h[1] == 0x2a && h[2] == 0x4d && h[3] == 0x18)
+      return zstd; // skippable frame, leading the frames of pzstd
+    if (n >= 10 && !memcmp(h,"\xff\x06\x00\x00sNaPpY",10))
+      return snappy;
+    return none;
+  }
+
+  const char* compressed_input::name(const codec &c)
+  {
+    switch (c)
+      {
+      case gzip: return "gzip";
+      case zstd: return "zstd";
+      case snappy: return "snappy";
+      default: return "none";
+      }
+  }
+
+  int compressed_input::open(const std::string &fname, const size_t &block_size)
+  {
+    close();
+    _codec = detect(fname);
+    _fd = ::open(fname.c_str(),O_RDONLY);
+    if (_fd < 0)
+      {
+	LOG(ERROR) << "Error opening file: " << fname;
+	return -1;
+      }
+    posix_fadvise(_fd,0,0,POSIX_FADV_SEQUENTIAL);
+    _fname = fname;
+    _block_size = std::max(block_size,(size_t)1);
+    _pending.clear();
+    _pending.reserve(_block_size + read_size);
+    _blocks.clear();
+    _done = _stop = _failed = false;
+    _decoder = std::thread(&compressed_input::decode,this);
+    return 0;
+  }
+
+  bool compressed_input::next(std::string &block, bool &last)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock,[this]{ return !_blocks.empty() || _done; });
+    if (_blocks.empty())
+      return false;
+    block.swap(_blocks.front().first);
+    last = _blocks.front().second;
+    _blocks.pop_front();
+    _cv.notify_all();
+    return true;
+  }
+
+  void compressed_input::close()
+  {
+    if (_decoder.joinable())
+      {
+	{
+	  std::lock_guard<std::mutex> lock(_mutex);
+	  _stop = true;
+	}
+	_cv.notify_all();
+	_decoder.join();
+      }
+    if (_fd >= 0)
+      ::close(_fd);
+    _fd = -1;
+    _blocks.clear();
+    std::string().swap(_pending);
+  }
+
+  void compressed_input::decode()
+  {
+    // the decoder inherits the cpu of the main thread, its parallel
+    // decompression goes to all of them
+    cpumap_pin_range(0,cpumap_ncpu());
+    bool ok = false;
+    if (_codec == gzip)
+      ok = decode_gzip();
+    else if (_codec == zstd)
+      ok = decode_zstd();
+    else if (_codec == snappy)
+      ok = decode_snappy();
+    else LOG(ERROR) << "not a compressed file: " << _fname;
+    if (ok && !_pending.empty())
+      push(_pending,true);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _failed = !ok && !_stop;
+    _done = true;
+    _cv.notify_all();
+  }
+
+  ssize_t compressed_input::refill(std::string &buf, size_t &pos)
+  {
+    buf.erase(0,pos);
+    pos = 0;
+    size_t size = buf.size();
+    buf.resize(size + read_size);
+    ssize_t n = read(_fd,&buf[size],read_size);
+    buf.resize(size + std::max(n,(ssize_t)0));
+    if (n < 0)
+      LOG(ERROR) << "Error reading file: " << _fname << ": " << strerror(errno);
+    return n;
+  }
+
+  bool compressed_input::output(const char *d, const size_t &n)
+  {
+    _pending.append(d,n);
+    // a block ends with the first line end from block_size bytes on, and
+    // is handed out once data follows it, so that the last one is known
+    while (_pending.size() > _block_size)
+      {
+	const char *eol = (const char*)memchr(&_pending[_block_size-1],'\n',_pending.size()-_block_size+1);
+	if (!eol || eol+1 == _pending.data() + _pending.size())
+	  break;
+	size_t len = eol+1 - _pending.data();
+	std::string block;
+	block.reserve(_block_size + read_size);
+	block.swap(_pending);
+	_pending.assign(block,len,std::string::npos);
+	block.resize(len);
+	if (!push(block,false))
+	  return false;
+      }
+    return true;
+  }
+
+  bool compressed_input::push(std::string &block, const bool &last)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock,[this]{ return _blocks.size() < max_ahead || _stop; });
+    if (_stop)
+      return false;
+    _blocks.push_back(std::make_pair(std::string(),last));
+    _blocks.back().first.swap(block);
+    _cv.notify_all();
+    return true;
+  }
+
+  bool compressed_input::decode_gzip()
+  {
+    // zlib cannot start inflating in the middle of a deflate stream: the
+    // members are inflated in turn by the decoder, ahead of the map
+    z_stream zs;
+    memset(&zs,0,sizeof(zs));
+    if (inflateInit2(&zs,15+32) != Z_OK)
+      {
+	LOG(ERROR) << "unable to initialize zlib";
+	return false;
+      }
+    std::string in;
+    size_t pos = 0;
+    std::vector<char> out(1<<20);
+    int ret = Z_OK;
+    bool ok = true;
+    for (;;)
+      {
+	if (zs.avail_in == 0)
+	  {
+	    ssize_t n = refill(in,pos);
+	    if (n <= 0)
+	      {
+		ok = n == 0 && ret == Z_STREAM_END;
+		if (n == 0 && !ok)
+		  LOG(ERROR) << "truncated gzip file: " << _fname;
+		break;
+	      }
+	    zs.next_in = (Bytef*)in.data();
+	    zs.avail_in = in.size();
+	    pos = in.size();
+	  }
+	if (ret == Z_STREAM_END)
+	  inflateReset(&zs); // next member of a concatenation, as written by pigz
+	zs.next_out = (Bytef*)out.data();
+	zs.avail_out = out.size();
+	ret = inflate(&zs,Z_NO_FLUSH);
+	if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+	  {
+	    LOG(ERROR) << "corrupted gzip file: " << _fname << ": " << (zs.msg ? zs.msg : "");
+	    ok = false;
+	    break;
+	  }
+	if (!output(out.data(),out.size()-zs.avail_out))
+	  break;
+      }
+    inflateEnd(&zs);
+    return ok;
+  }
+
+  bool compressed_input::decode_zstd()
+  {
+#ifdef HAVE_ZSTD_H
+    // the frames of known size that follow in the input are decompressed
+    // in parallel, as written by pzstd or zstd -B; a frame of unknown or
+    // too large size, e.g. the single frame of zstd, is streamed
+    enum { max_parallel_output = 256<<20 };
+    struct frame
+    {
+      size_t _pos;
+      size_t _size;
+      size_t _content;
+    };
+    std::string in;
+    size_t pos = 0;
+    bool eof = false;
+    std::vector<char> out(1<<20);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    bool ok = dctx != nullptr;
+    while (ok)
+      {
+	if (!eof && in.size() - pos < (size_t)read_size)
+	  {
+	    ssize_t n = refill(in,pos);
+	    if (n < 0)
+	      ok = false;
+	    eof = n <= 0;
+	  }
+	if (!ok || pos == in.size())
+	  break;
+	std::vector<frame> frames;
+	size_t p = pos, total = 0;
+	while (p < in.size())
+	  {
+	    size_t fsize = ZSTD_findFrameCompressedSize(in.data()+p,in.size()-p);
+	    if (ZSTD_isError(fsize))
+	      break;
+	    unsigned long long content = ZSTD_getFrameContentSize(in.data()+p,fsize);
+	    if (content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR
+		|| total + content > max_parallel_output)
+	      break;
+	    frame f = { p, fsize, (size_t)content };
+	    frames.push_back(f);
+	    total += content;
+	    p += fsize;
+	  }
+	if (!frames.empty())
+	  {
+	    std::vector<std::string> outs(frames.size());
+	    bool err = false;
+#pragma omp parallel for schedule(dynamic,1)
+	    for (size_t i = 0; i < frames.size(); i++)
+	      {
+		outs[i].resize(frames[i]._content);
+		size_t r = ZSTD_decompress(&outs[i][0],outs[i].size(),in.data()+frames[i]._pos,frames[i]._size);
+		if (ZSTD_isError(r) || r != frames[i]._content)
+		  err = true;
+	      }
+	    if (err)
+	      {
+		LOG(ERROR) << "corrupted zstd file: " << _fname;
+		ok = false;
+		break;
+	      }
+	    for (size_t i = 0; i < outs.size(); i++)
+	      if (!output(outs[i].data(),outs[i].size()))
+		ok = false;
+	    if (!ok)
+	      break;
+	    pos = p;
+	    continue;
+	  }
+
+	// one frame streamed
+	ZSTD_inBuffer zin = { in.data()+pos, in.size()-pos, 0 };
+	for (;;)
+	  {
+	    ZSTD_outBuffer zout = { out.data(), out.size(), 0 };
+	    size_t r = ZSTD_decompressStream(dctx,&zout,&zin);
+	    if (ZSTD_isError(r))
+	      {
+		LOG(ERROR) << "corrupted zstd file: " << _fname << ": " << ZSTD_getErrorName(r);
+		ok = false;
+		break;
+	      }
+	    if (zout.pos && !output(out.data(),zout.pos))
+	      {
+		ok = false;
+		break;
+	      }
+	    if (r == 0)
+	      break;
+	    if (zin.pos == zin.size && zout.pos < zout.size)
+	      {
+		pos += zin.pos;
+		ssize_t n = eof ? 0 : refill(in,pos);
+		if (n <= 0)
+		  {
+		    if (n == 0)
+		      LOG(ERROR) << "truncated zstd file: " << _fname;
+		    ok = false;
+		    break;
+		  }
+		zin.src = in.data()+pos;
+		zin.size = in.size()-pos;
+		zin.pos = 0;
+	      }
+	  }
+	pos += zin.pos;
+      }
+    if (dctx)
+      ZSTD_freeDCtx(dctx);
+    return ok || _stop;
+#else
+    LOG(ERROR) << "zstd file " << _fname << " requires zstd, which miw was built without";
+    return false;
+#endif
+  }
+
+  bool compressed_input::decode_snappy()
+  {
+#ifdef HAVE_SNAPPY_H
+    // framing format: chunks of a type byte and a 24 bits length, the
+    // compressed and uncompressed ones holding a masked CRC-32C, not
+    // checked, then at most 64KB of data. The chunks of the input read
+    // so far are decompressed in parallel.
+    std::string in;
+    size_t pos = 0;
+    bool eof = false;
+    bool ok = true;
+    while (ok)
+      {
+	if (!eof && in.size() - pos < (size_t)read_size)
+	  {
+	    ssize_t n = refill(in,pos);
+	    if (n < 0)
+	      return false;
+	    eof = n == 0;
+	  }
+	if (pos == in.size())
+	  break;
+	std::vector<std::pair<size_t,size_t>> chunks; // data of the data chunks
+	std::vector<bool> compressed;
+	size_t p = pos;
+	while (p + 4 <= in.size())
+	  {
+	    unsigned char type = in[p];
+	    size_t len = (unsigned char)in[p+1] | ((unsigned char)in[p+2] << 8) | ((unsigned char)in[p+3] << 16);
+	    if (p + 4 + len > in.size())
+	      break;
+	    if (type <= 0x01)
+	      {
+		if (len < 4)
+		  {
+		    LOG(ERROR) << "corrupted snappy file: " << _fname;
+		    return false;
+		  }
+		chunks.push_back(std::make_pair(p+8,len-4));
+		compressed.push_back(type == 0x00);
+	      }
+	    else if (type < 0x80)
+	      {
+		LOG(ERROR) << "unsupported snappy chunk type " << (int)type << " in file: " << _fname;
+		return false;
+	      }
+	    p += 4 + len; // skippable chunks and stream identifiers
+	  }
+	if (p == pos)
+	  {
+	    if (eof)
+	      {
+		LOG(ERROR) << "truncated snappy file: " << _fname;
+		return false;
+	      }
+	    ssize_t n = refill(in,pos);
+	    if (n < 0)
+	      return false;
+	    eof = n == 0;
+	    continue;
+	  }
+	std::vector<std::string> outs(chunks.size());
+	bool err = false;
+#pragma omp parallel for schedule(dynamic,64)
+	for (size_t i = 0; i < chunks.size(); i++)
+	  {
+	    if (!compressed[i])
+	      outs[i].assign(in,chunks[i].first,chunks[i].second);
+	    else if (!snappy::Uncompress(in.data()+chunks[i].first,chunks[i].second,&outs[i]))
+	      err = true;
+	  }
+	if (err)
+	  {
+	    LOG(ERROR) << "corrupted snappy file: " << _fname;
+	    return false;
+	  }
+	for (size_t i = 0; i < outs.size() && ok; i++)
+	  ok = output(outs[i].data(),outs[i].size());
+	pos = p;
+      }
+    return ok || _stop;
+#else
+    LOG(ERROR) << "snappy file " << _fname << " requires snappy, which miw was built without";
+    return false;
+#endif
+  }
+
+}
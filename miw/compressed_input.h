@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COMPRESSED_INPUT_H
+#define COMPRESSED_INPUT_H
+
+#include <string>
+#include <deque>
+#include <sys/types.h>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace miw
+{
+  /**
+   * Streaming reader of a compressed input file, gzip, zstd or
+   * snappy-framed as told by its first bytes, so that it is processed
+   * without being decompressed to disk first. A decoder thread cuts the
+   * decompressed data into blocks of whole lines, and keeps at most
+   * max_ahead of them ready while the previous ones are processed.
+   * Independent zstd frames and snappy chunks are decompressed in
+   * parallel, gzip members in turn.
+   */
+  class compressed_input
+  {
+  public:
+    enum codec { none, gzip, zstd, snappy };
+    
+    compressed_input() {}
+    ~compressed_input() { close(); }
+
+    // codec of fname from its first bytes, none for a plain file.
+    static codec detect(const std::string &fname);
+    static const char* name(const codec &c);
+
+    // opens fname and starts its decoder, blocks being cut at the first
+    // line end from block_size bytes on. -1 on error.
+    int open(const std::string &fname, const size_t &block_size);
+
+    // next block, last being set for the last one of the file. false at
+    // the end of the file or on error.
+    bool next(std::string &block, bool &last);
+
+    // stops the decoder and closes the file.
+    void close();
+
+    bool failed() const { return _failed; }
+    
+  private:
+    void decode();
+    bool decode_gzip();
+    bool decode_zstd();
+    bool decode_snappy();
+
+    // reads more input after the bytes of buf from pos on, which are
+    // moved to its start. -1 on error, 0 at the end of the file.
+    ssize_t refill(std::string &buf, size_t &pos);
+
+    // adds decompressed data, handing out the blocks it completes.
+    // false once the reader is closed.
+    bool output(const char *d, const size_t &n);
+    bool push(std::string &block, const bool &last);
+    
+    int _fd = -1;
+    codec _codec = none;
+    std::string _fname;
+    size_t _block_size = 0;
+    std::string _pending; // decompressed data of the next block
+    std::deque<std::pair<std::string,bool>> _blocks; // blocks ready, and whether last
+    std::thread _decoder;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _done = false;
+    bool _stop = false;
+    bool _failed = false;
+    enum { max_ahead = 2 }; // blocks decompressed ahead of the reader
+    enum { read_size = 8<<20 }; // compressed bytes read at once
+  };
+
+}
+
+#endif
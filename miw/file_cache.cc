@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "file_cache.h"
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  int file_cache::open(const std::string &dir, const std::string &format_key)
+  {
+    if (mkdir(dir.c_str(),0755) != 0 && errno != EEXIST)
+      {
+	LOG(ERROR) << "unable to create cache directory " << dir << ": " << strerror(errno);
+	return -1;
+      }
+    _dir = dir;
+    _format = hash(format_key.data(),format_key.length());
+    return 0;
+  }
+
+  std::string file_cache::path(const std::string &fname, const struct stat &st) const
+  {
+    int fd = ::open(fname.c_str(),O_RDONLY);
+    if (fd < 0)
+      return "";
+    const size_t fsize = st.st_size;
+    std::vector<char> buf(std::min(fsize,(size_t)sample_size));
+    uint64_t h = hash((const char*)&_format,sizeof(_format));
+    uint64_t size = fsize;
+    int64_t mtime[2] = { (int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec };
+    h = hash((const char*)&size,sizeof(size),h);
+    h = hash((const char*)mtime,sizeof(mtime),h);
+    bool ok = pread(fd,buf.data(),buf.size(),0) == (ssize_t)buf.size();
+    h = hash(buf.data(),buf.size(),h);
+    ok = ok && pread(fd,buf.data(),buf.size(),fsize-buf.size()) == (ssize_t)buf.size();
+    h = hash(buf.data(),buf.size(),h);
+    ::close(fd);
+    if (!ok)
+      return "";
+    char name[32];
+    snprintf(name,sizeof(name),"%016llx.part",(unsigned long long)h);
+    return _dir + "/" + name;
+  }
+
+  uint64_t file_cache::hash(const char *d, const size_t &len, uint64_t h)
+  {
+    for (size_t i=0;i<len;i++)
+      {
+	h ^= (unsigned char)d[i];
+	h *= 1099511628211ULL;
+      }
+    return h;
+  }
+  
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+namespace miw
+{
+  /**
+   * Cache of the merged results of single input files, so that a later
+   * job merging the same files only processes the new ones. An entry is
+   * a checkpoint of the results of one file, named after the fingerprint
+   * of the file, its size, modification time and hashes of its head and
+   * tail, and after a key of the format and options the results depend
+   * on. The name of the file is not part of it, so that entries survive
+   * the rotation of the logs.
+   */
+  class file_cache
+  {
+  public:
+    file_cache() {}
+
+    // directory of the entries, created if needed, and key of the format.
+    // -1 if the directory can not be created.
+    int open(const std::string &dir, const std::string &format_key);
+
+    bool is_open() const { return !_dir.empty(); }
+
+    // path of the entry of fname, empty if the file can not be read.
+    std::string path(const std::string &fname, const struct stat &st) const;
+
+    // FNV-1a hash of len bytes of d, from h.
+    static uint64_t hash(const char *d, const size_t &len, uint64_t h=14695981039346656037ULL);
+
+  private:
+    enum { sample_size = 65536 }; // bytes of the head and tail hashed
+    std::string _dir;
+    uint64_t _format = 0; // hash of the format key
+  };
+
+}
+
+#endif
@@ -27,12 +27,21 @@
  */
 
 #include "job.h"
+#include "cgroup.hh"
+#include "cpumap.hh"
 #include <chrono>
+#include <algorithm>
+#include <dirent.h>
+#include <glob.h>
 #include <sys/sysinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
-DEFINE_string(fnames,"","comma-separated input file names");
+DEFINE_string(fnames,"","comma-separated input file names, directories or glob patterns, gzip, zstd or snappy-framed files being decompressed as they are processed");
 DEFINE_int32(nprocs,0,"number of cores (default = auto)");
 DEFINE_int32(ndisp,5,"number of top records to show");
 DEFINE_int32(map_tasks,0,"number of map tasks (default = auto)");
@@ -42,13 +51,31 @@ DEFINE_bool(autosplit,false,"whether to autosplit file based on available memory
 DEFINE_string(ofname,"","output file name");
 DEFINE_string(format_name,"","processing format name");
 DEFINE_string(appname,"","optional application name");
-DEFINE_string(output_format,"","output format (json, csv)");
+DEFINE_string(output_format,"","output format (json, csv, columnar)");
 DEFINE_bool(store_content,false,"whether to store the original content in the processed output");
 DEFINE_bool(compressed,false,"whether to compress the original content");
 DEFINE_bool(merge_results,false,"whether to merge results over multiple input files");
-DEFINE_double(memory_factor,10.0,"heuristic value for autosplit of very large files, representing the expected memory requirement ratio vs the size of the file, e.g. 10 times more memory than log volume");
+DEFINE_double(memory_factor,0.0,"heuristic value for autosplit of very large files, representing the expected memory requirement ratio vs the size of the file, e.g. 10 times more memory than log volume (0 = 10 for the first chunk, then the ratio measured while sampling)");
+DEFINE_int32(max_memory,0,"memory budget in MB, implies autosplit: input chunks are sized to half of it with memory_factor, and merged results beyond the other half are spilled to sorted run files on disk, merged back into the output in key order (0 = no budget)");
+DEFINE_string(spill_dir,"","directory of the files of spilled results (default = TMPDIR or /tmp)");
 DEFINE_bool(skip_header,false,"whether to skip first log line file as header");
-DEFINE_bool(tmp_save,false,"whether to save temporary output of results after each file is processed");
+DEFINE_bool(tmp_save,false,"whether to save a checkpoint of the merged results in ofname.ckpt after each input file, written in the background");
+DEFINE_string(cache_dir,"","directory of the cached results of single input files, merged results only (implies autosplit): the files already processed with the same format are read from the cache instead");
+DEFINE_string(resume,"","checkpoint of merged results to resume from, as saved by tmp_save: the input it covers is skipped");
+DEFINE_bool(resample,false,"whether to sample every input file for its number of keys, instead of reusing the prediction from the first file");
+DEFINE_bool(counter,true,"whether to count logs per key without building records when the format aggregates no field");
+DEFINE_string(order,"none","order of the output records: none, key, count or the name of an aggregated numerical field, by decreasing value");
+DEFINE_int32(order_limit,0,"number of leading output records to order, the rest following unordered (default = all)");
+DEFINE_int32(output_shards,0,"number of output files written in parallel by the reduce tasks, unordered json or csv output only (0 = single writer)");
+DEFINE_string(csv_quoting,"strings","quoting of the CSV cells: strings, minimal (only the cells that need it) or all");
+DEFINE_string(csv_separator,",","separator of the CSV cells, a single character or tab");
+DEFINE_int32(output_cores,0,"number of cores of the output stage, which writes the results of a file or chunk while the next one is processed on the other cores (0 = no pipelining)");
+DEFINE_int32(workers,0,"number of worker processes the input bytes are split over, each processing a range of the input files: their partial merged results are merged into the output, merged results only (0 = no workers)");
+DEFINE_string(worker_template,"{exe} {args}","command line of a worker, run by /bin/sh: {exe} is this program, {args} the arguments of the worker and {id} its number, e.g. ssh node{id} {exe} {args} with the files and ofname on a shared file system");
+DEFINE_string(worker_out,"","file of the partial merged results of a worker, written instead of the output");
+DEFINE_uint64(first_offset,0,"offset in the first input file of a worker, from the line at or after it");
+DEFINE_uint64(last_offset,0,"offset in the last input file of a worker, up to the line at or after it (0 = end of the file)");
+DEFINE_bool(value_modifier,false,"whether to merge each log record into a single record per key and worker as it is emitted, instead of buffering them for the combiner");
 
 namespace miw
 {    
@@ -67,16 +94,21 @@ namespace miw
   
 int job::execute(int argc, char *argv[])
   {
+    // the workers get the arguments of the coordinator, as they were
+    _args.assign(argv+1,argv+argc);
     google::ParseCommandLineFlags(&argc,&argv,true);
     glog_init(argv);
     FLAGS_logtostderr = 1;
     str_utils::str_split(FLAGS_fnames,',',_files);
+    expand_files();
     _nprocs = FLAGS_nprocs;
     _ndisp = FLAGS_ndisp;
     _map_tasks = FLAGS_map_tasks;
     _reduce_tasks = FLAGS_reduce_tasks;
     _quiet = FLAGS_quiet;
-    _autosplit = FLAGS_autosplit;
+    _max_memory = std::max(0,FLAGS_max_memory) * 1024UL * 1024UL;
+    _spill_dir = FLAGS_spill_dir;
+    _autosplit = FLAGS_autosplit || _max_memory > 0 || (!FLAGS_cache_dir.empty() && FLAGS_merge_results);
     _ofname = FLAGS_ofname;
     _format_name = FLAGS_format_name;
     _app_name = FLAGS_appname;
@@ -84,19 +116,71 @@ int job::execute(int argc, char *argv[])
     _compressed = FLAGS_compressed;
     _output_format = FLAGS_output_format;
     _merge_results = FLAGS_merge_results;
-    _in_memory_factor = FLAGS_memory_factor;
+    _calibrate_memory = FLAGS_memory_factor <= 0.0;
+    if (!_calibrate_memory)
+      _in_memory_factor = FLAGS_memory_factor;
     _skip_header = FLAGS_skip_header;
     _tmp_save = FLAGS_tmp_save;
+    _resume = FLAGS_resume;
+    _resample = FLAGS_resample;
+    _value_modifier = FLAGS_value_modifier;
+    _order = FLAGS_order;
+    _order_limit = std::max(0,FLAGS_order_limit);
+    _csv_quoting = FLAGS_csv_quoting;
+    _csv_separator = FLAGS_csv_separator;
+    _output_cores = std::max(0,FLAGS_output_cores);
+    _workers = std::max(0,FLAGS_workers);
+    _worker_template = FLAGS_worker_template;
+    _worker_out = FLAGS_worker_out;
+    _first_offset = FLAGS_first_offset;
+    _last_offset = FLAGS_last_offset;
+    if (_workers > 0 || !_worker_out.empty())
+      {
+	// workers merge their results, and split their files as needed
+	_merge_results = true;
+	_autosplit = true;
+      }
+    if (!_autosplit && _merge_results && _tmp_save)
+      {
+	// checkpoints are saved between files: the files are processed in turn
+	LOG(INFO) << "tmp_save, merging the files in turn";
+	_autosplit = true;
+      }
+    if (!_autosplit && _merge_results)
+      for (size_t j=0;j<_files.size();j++)
+	if (compressed_input::detect(_files.at(j)) != compressed_input::none)
+	  {
+	    // compressed files are not mapped: the files are processed in turn
+	    LOG(INFO) << "compressed file=" << _files.at(j) << ", merging the files in turn";
+	    _autosplit = true;
+	    break;
+	  }
     
     // list input files
     std::cerr << "files=" << FLAGS_fnames << std::endl;
 
     
     // if in memory results, allocate the final object
-    if (_output_format == "mem")
+    if (!_worker_out.empty())
+      LOG(INFO) << "worker of files=" << FLAGS_fnames << " from byte " << _first_offset << " to " << _last_offset << ", partial results in " << _worker_out;
+    else if (_output_format == "mem")
       _results = new xarray<keyval_t>();
+    else if (_output_format == "columnar")
+      {
+	if (_columnar.open(_ofname) < 0)
+	  return 1;
+      }
+    else if (FLAGS_output_shards > 0 && _order == "none"
+	     && (_output_format == "json" || _output_format == "csv")
+	     && !(_autosplit && _merge_results))
+      {
+	if (_shards.open(_ofname,FLAGS_output_shards) < 0)
+	  return 1;
+      }
     else
       {
+	if (FLAGS_output_shards > 0)
+	  LOG(WARNING) << "sharded output requires unordered json or csv output, writing a single file";
 	//TODO: open temporary output file if option is on
 	// open output file
 	_fout.open(_ofname);
@@ -113,15 +197,129 @@ int job::execute(int argc, char *argv[])
 	LOG(ERROR) << "Error opening the log format file";
 	return 1;
       }
+    _counter = FLAGS_counter && !_store_content && !_compressed && _lf.count_only();
+
+    // cached results depend on the format and on the options of the records
+    if (!FLAGS_cache_dir.empty() && !_merge_results)
+      LOG(WARNING) << "the cache holds merged results, ignoring cache_dir without merge_results";
+    else if (!FLAGS_cache_dir.empty())
+      {
+	std::string format_key = _lf._ldef.SerializeAsString() + '\0' + _app_name
+	  + (_store_content ? "s" : "") + (_compressed ? "c" : "") + (_skip_header ? "h" : "");
+	if (_cache.open(FLAGS_cache_dir,format_key) < 0)
+	  return 1;
+      }
 
     return execute();
   }
   
+  namespace
+  {
+    // offset past the first line end at or after pos, or fsize.
+    size_t line_end(const int &fd, size_t pos, const size_t &fsize)
+    {
+      char buf[65536];
+      while (pos < fsize)
+	{
+	  ssize_t n = pread(fd,buf,std::min(sizeof(buf),fsize-pos),pos);
+	  if (n <= 0)
+	    return fsize;
+	  const char *eol = (const char*)memchr(buf,'\n',n);
+	  if (eol)
+	    return pos + (eol - buf) + 1;
+	  pos += n;
+	}
+      return fsize;
+    }
+
+    // offset of the first line starting at or after off in fname, the
+    // bound of the byte ranges of the workers.
+    size_t line_offset(const std::string &fname, const size_t &off)
+    {
+      if (off == 0)
+	return 0;
+      struct stat st;
+      int fd = open(fname.c_str(),O_RDONLY);
+      if (fd < 0 || fstat(fd,&st) != 0)
+	{
+	  LOG(ERROR) << "Error opening file: " << fname;
+	  if (fd >= 0)
+	    close(fd);
+	  return off;
+	}
+      size_t pos = line_end(fd,off-1,st.st_size);
+      close(fd);
+      return pos;
+    }
+
+    // argument quoted for /bin/sh.
+    std::string shell_quote(const std::string &arg)
+    {
+      std::string q = "'";
+      for (size_t i = 0; i < arg.length(); i++)
+	{
+	  if (arg[i] == '\'')
+	    q += "'\\''";
+	  else q += arg[i];
+	}
+      return q + "'";
+    }
+
+    void replace_all(std::string &str, const std::string &from, const std::string &to)
+    {
+      size_t pos = 0;
+      while ((pos = str.find(from,pos)) != std::string::npos)
+	{
+	  str.replace(pos,from.length(),to);
+	  pos += to.length();
+	}
+    }
+  }
+  
   int job::execute()
   {
     LOG(INFO) << "files size=" << _files.size();
+    if (_workers > 0)
+      return run_coordinator();
     std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
-    for (size_t j=0;j<_files.size();j++)
+    // the worker pool is created by the first run and stays up for the
+    // next files and jobs of the process
+    mapreduce_appbase::initialize();
+    if (_output_cores > 0 && (_autosplit || !_merge_results))
+      {
+	// the map reduce workers keep the first cores, the output of a run
+	// goes on the next ones while the following run is processed
+	int ncpu = cpumap_ncpu();
+	if (_nprocs <= 0)
+	  _nprocs = std::max(1,ncpu - _output_cores);
+	_stage.start(_nprocs,_output_cores);
+	LOG(INFO) << "pipelined output: " << _nprocs << " map reduce cores, " << _output_cores << " output cores";
+      }
+    // a resumed job starts where its checkpoint ends
+    size_t first_file = 0, first_offset = 0;
+    if (!_resume.empty() && resume_checkpoint(first_file,first_offset) < 0)
+      return 1;
+    else if (_first_offset > 0 && !_files.empty())
+      first_offset = line_offset(_files.at(0),_first_offset);
+    if (!_autosplit && _merge_results)
+      {
+	// all the files form a single split space, processed by one Metis run
+	size_t total_size = 0;
+	for (size_t j=0;j<_files.size();j++)
+	  {
+	    struct stat st;
+	    if (stat(_files.at(j).c_str(),&st)!=0)
+	      {
+		LOG(ERROR) << "Error file not found: " << _files.at(j);
+		return 1;
+	      }
+	    total_size += st.st_size;
+	  }
+	LOG(INFO) << "Processing " << _files.size() << " files, " << total_size << " bytes";
+	if (total_size > 0)
+	  run_mr_job(_files,0);
+      }
+    else for (size_t j=first_file;j<_files.size();j++)
       {
 	std::string fname = _files.at(j);
 	LOG(INFO) << "Processing file=" << fname;
@@ -131,39 +329,73 @@ int job::execute(int argc, char *argv[])
 	    LOG(ERROR) << "Error file not found: " << fname;
 	    return 1;
 	  }
-	if (!_autosplit && !_merge_results)
+	if (compressed_input::detect(fname) != compressed_input::none)
 	  {
-	    run_mr_job(fname.c_str(),j);
+	    // a compressed file is not split between workers, the one of its
+	    // first byte processes it
+	    if (j == 0 && _first_offset > 0)
+	      continue;
+	    if (run_compressed(fname,j,st) < 0)
+	      return 1;
 	  }
-	else if (!_autosplit && _merge_results)
+	else if (!_autosplit)
 	  {
-	    run_mr_job_merge_results(fname.c_str(),j,j==_files.size()-1,true);
+	    run_mr_job(fname.c_str(),j);
 	  }
 	else
 	  {
 	    size_t mfsize = 0;
 	    size_t nchunks = 1;
-	    bool do_autosplit = file_size_autosplit(st.st_size,mfsize,nchunks);
+	    size_t start = j == first_file ? first_offset : 0;
+	    // the range of a worker ends with the line at its last offset
+	    const size_t fsize = j+1 == _files.size() && _last_offset > 0 && _last_offset < (size_t)st.st_size
+	      ? std::max(start,line_offset(fname,_last_offset)) : st.st_size;
+	    std::string cache_file;
+	    if (_cache.is_open() && start == 0 && fsize == (size_t)st.st_size)
+	      {
+		cache_file = _cache.path(fname,st);
+		if (!cache_file.empty() && read_cached(cache_file,fname))
+		  continue;
+	      }
+	    bool do_autosplit = file_size_autosplit(fsize-start,mfsize,nchunks);
 	    LOG(INFO) << "do_autosplit: " << do_autosplit << std::endl;
 	    if (do_autosplit)
 	      {
 		LOG(INFO) << "Working on " << nchunks << " splitted chunks of " << mfsize << " bytes\n";
-		std::ifstream fin(fname);
-		for (size_t ch=0;ch<nchunks;ch++)
+		// chunks are windows mapped over the file in turn, each ending
+		// with the line at its nominal size, while the next one is read ahead
+		int fd = open(fname.c_str(),O_RDONLY);
+		if (fd < 0)
 		  {
-		    bool run_end = (j == _files.size()-1) && (ch == nchunks-1);
-		    std::string line,buf;
-		    while(buf.length() < mfsize)
+		    LOG(ERROR) << "Error opening file: " << fname;
+		    return 1;
+		  }
+		for (size_t ch=0;start<fsize;ch++)
+		  {
+		    if (ch > 0 && _nchunks_split == 0)
 		      {
-			if (!std::getline(fin,line))
-			  break;
-			buf += line + "\n";
+			// the memory left after the previous chunks sizes the next ones
+			size_t nleft = 1;
+			file_size_autosplit(fsize-start,mfsize,nleft);
+			nchunks = ch + nleft;
 		      }
+		    size_t end = ch+1 < nchunks ? line_end(fd,start+std::max(mfsize,(size_t)1)-1,fsize) : fsize;
+		    if (end < fsize)
+		      posix_fadvise(fd,end,std::min(mfsize,fsize-end),POSIX_FADV_WILLNEED);
+		    bool run_end = (j == _files.size()-1) && (end == fsize);
+		    mmap_file window(fname.c_str(),start,end-start);
 		    LOG(INFO) << "--> Chunk #" << ch+1 << " / " << nchunks;
 		    if (!_merge_results)
-		      run_mr_job(const_cast<char*>(buf.c_str()),j,buf.length());
-		    else run_mr_job_merge_results(const_cast<char*>(buf.c_str()),j+ch,run_end,buf.length(),ch==0);
+		      run_mr_job(window.d_,j,window.size_);
+		    else
+		      {
+			checkpoint pos(j,end,fname);
+			run_mr_job_merge_results(window.d_,j+ch,run_end,window.size_,
+						 pos,ch==0,end==fsize,cache_file);
+		      }
+		    start = end;
 		  }
+		close(fd);
 	      }
 	    else
 	      {
@@ -171,39 +403,256 @@ int job::execute(int argc, char *argv[])
 	      }
 	  }
       }
+    if (_autosplit && _merge_results && !_finalized && !_files.empty())
+      {
+	// the last files were read from the cache, or empty: a run over an
+	// empty line merges what is left into the output
+	static char empty_line[] = "\n";
+	run_mr_job_merge_results(empty_line,_files.size()-1,true,1,checkpoint(),false,false,"");
+      }
+    _stage.stop();
+    if (_mrj)
+      {
+	delete _mrj;
+	_mrj = nullptr;
+      }
     if (_fout.is_open())
       _fout.close();
+    _shards.close();
+    _columnar.close();
 
     // final timing
     std::chrono::time_point<std::chrono::system_clock> tstop = std::chrono::system_clock::now();
     double duration = std::chrono::duration_cast<std::chrono::seconds>(tstop-tstart).count();
     LOG(INFO) << "MR duration=" << duration << " seconds\n";
     
+    return _failed ? 1 : 0;
+  }
+
+  int job::run_compressed(const std::string &fname, const size_t &nfile, const struct stat &st)
+  {
+    compressed_input::codec codec = compressed_input::detect(fname);
+    std::string cache_file;
+    if (_merge_results && _cache.is_open())
+      {
+	cache_file = _cache.path(fname,st);
+	if (!cache_file.empty() && read_cached(cache_file,fname))
+	  return 0;
+      }
+    // the decompressed size is only known at the end: blocks are sized as
+    // the chunks of a file compressed_ratio times larger
+    size_t mfsize = 0, nchunks = 1;
+    file_size_autosplit(std::max((size_t)st.st_size * compressed_ratio,(size_t)min_chunk_size),mfsize,nchunks);
+    LOG(INFO) << "Working on " << compressed_input::name(codec) << " compressed file, in blocks of " << mfsize << " bytes\n";
+    compressed_input in;
+    if (in.open(fname,mfsize) < 0)
+      return -1;
+    std::string block;
+    bool last = false;
+    size_t end = 0;
+    for (size_t ch=0;!last && in.next(block,last);ch++)
+      {
+	end += block.size();
+	LOG(INFO) << "--> Block #" << ch+1 << " of " << block.size() << " bytes";
+	if (!_merge_results)
+	  run_mr_job(&block[0],nfile,block.size());
+	else
+	  {
+	    // a checkpoint at the end of the file is past its last byte
+	    bool run_end = (nfile == _files.size()-1) && last;
+	    checkpoint pos(nfile,last ? (size_t)st.st_size : end,fname);
+	    run_mr_job_merge_results(&block[0],nfile+ch,run_end,block.size(),
+				     pos,ch==0,last,cache_file);
+	  }
+      }
+    in.close();
+    if (in.failed())
+      {
+	LOG(ERROR) << "Error decompressing file: " << fname;
+	return -1;
+      }
+    LOG(INFO) << "decompressed " << end << " bytes of file=" << fname;
     return 0;
   }
 
+  int job::run_coordinator()
+  {
+    std::chrono::time_point<std::chrono::system_clock> tstart = std::chrono::system_clock::now();
+    // the bytes of the files are split evenly into contiguous ranges, a
+    // range boundary within a file going to the line that starts there
+    std::vector<size_t> offsets(1,0); // offset of each file in the input
+    for (size_t j=0;j<_files.size();j++)
+      {
+	struct stat st;
+	if (stat(_files.at(j).c_str(),&st)!=0)
+	  {
+	    LOG(ERROR) << "Error file not found: " << _files.at(j);
+	    return 1;
+	  }
+	offsets.push_back(offsets.back() + st.st_size);
+      }
+    const size_t total_size = offsets.back();
+    const size_t nworkers = std::min((size_t)_workers,total_size);
+    std::string base = _ofname;
+    if (base.empty())
+      {
+	const char *tmpdir = getenv("TMPDIR");
+	base = _spill_dir.empty() ? (tmpdir && *tmpdir ? tmpdir : "/tmp") : _spill_dir;
+	base += "/miw_" + std::to_string(getpid());
+      }
+    char exe[4096];
+    ssize_t n = readlink("/proc/self/exe",exe,sizeof(exe)-1);
+    exe[std::max(n,(ssize_t)0)] = '\0';
+    std::vector<std::string> parts;
+    std::vector<pid_t> pids;
+    for (size_t i=0;i<nworkers;i++)
+      {
+	size_t first = total_size * i / nworkers, last = total_size * (i+1) / nworkers;
+	size_t ffile = std::upper_bound(offsets.begin(),offsets.end(),first) - offsets.begin() - 1;
+	size_t lfile = std::upper_bound(offsets.begin(),offsets.end(),last-1) - offsets.begin() - 1;
+	std::string fnames;
+	for (size_t j=ffile;j<=lfile;j++)
+	  fnames += (j > ffile ? "," : "") + _files.at(j);
+	size_t last_offset = last - offsets.at(lfile);
+	if (last == offsets.at(lfile+1))
+	  last_offset = 0;
+	parts.push_back(base + ".part" + std::to_string(i));
+	std::vector<std::string> args = _args;
+	std::vector<std::string> wargs = { "-fnames", fnames,
+					   "-first_offset", std::to_string(first - offsets.at(ffile)),
+					   "-last_offset", std::to_string(last_offset),
+					   "-workers", "0", "-worker_out", parts.back(),
+					   "-tmp_save=false", "-resume=" };
+	args.insert(args.end(),wargs.begin(),wargs.end());
+	std::string qargs;
+	for (size_t a=0;a<args.size();a++)
+	  qargs += (a > 0 ? " " : "") + shell_quote(args.at(a));
+	std::string cmd = _worker_template;
+	replace_all(cmd,"{exe}",shell_quote(exe));
+	replace_all(cmd,"{args}",qargs);
+	replace_all(cmd,"{id}",std::to_string(i));
+	LOG(INFO) << "worker #" << i << ": bytes " << first << " to " << last << ", " << cmd;
+	pid_t pid = fork();
+	if (pid == 0)
+	  {
+	    execl("/bin/sh","sh","-c",cmd.c_str(),(char*)nullptr);
+	    _exit(127);
+	  }
+	if (pid < 0)
+	  {
+	    LOG(ERROR) << "unable to start worker #" << i << ": " << strerror(errno);
+	    _failed = true;
+	    break;
+	  }
+	pids.push_back(pid);
+      }
+    for (size_t i=0;i<pids.size();i++)
+      {
+	int status = 0;
+	if (waitpid(pids.at(i),&status,0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	  {
+	    LOG(ERROR) << "worker #" << i << " failed, status=" << status;
+	    _failed = true;
+	  }
+      }
+
+    // the sorted partial results are merged into the output, one key at a time
+    static char empty_line[] = "\n";
+    _mrj = new mr_job(empty_line,1,_map_tasks,_app_name,&_lf,_store_content,_compressed,_quiet,_skip_header);
+    _mrj->set_order(_order,_order_limit);
+    _mrj->set_csv(_csv_quoting,_csv_separator);
+    if (_columnar.is_open())
+      _mrj->set_columnar(&_columnar);
+    for (size_t i=0;i<parts.size();i++)
+      {
+	if (!_failed && _mrj->add_partial(parts.at(i)) < 0)
+	  _failed = true;
+	unlink(parts.at(i).c_str());
+      }
+    if (!_failed)
+      _mrj->output_spilled(_output_format,-1,_ndisp,_fout,_results);
+    delete _mrj;
+    _mrj = nullptr;
+    if (_fout.is_open())
+      _fout.close();
+    _columnar.close();
+
+    std::chrono::time_point<std::chrono::system_clock> tstop = std::chrono::system_clock::now();
+    double duration = std::chrono::duration_cast<std::chrono::seconds>(tstop-tstart).count();
+    LOG(INFO) << "MR duration=" << duration << " seconds with " << nworkers << " workers\n";
+    return _failed ? 1 : 0;
+  }
+
 void job::run_mr_job(const char *fname, const int &nfile, const size_t &blength)
 {
-  mapreduce_appbase::initialize();
-  if (blength) // from buffer
-    _mrj = new mr_job(const_cast<char*>(fname),blength, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
-  else _mrj = new mr_job(fname, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
+  // the mr job, and with it the bucket managers and the sampled number
+  // of reduce tasks, is kept across the input files
+  if (!_mrj)
+    {
+      if (blength) // from buffer
+	_mrj = new mr_job(const_cast<char*>(fname),blength, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
+      else _mrj = new mr_job(fname, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
+      _mrj->set_sample_reuse(!_resample);
+      _mrj->set_value_modifier(_value_modifier);
+      _mrj->set_order(_order,_order_limit);
+      _mrj->set_csv(_csv_quoting,_csv_separator);
+      if (_shards.size())
+	_mrj->set_output_shards(&_shards);
+      if (_columnar.is_open())
+	_mrj->set_columnar(&_columnar);
+      if (_stage.is_running())
+	_mrj->set_output_stage(&_stage);
+      _mrj->set_counter(_counter);
+    }
+  else if (blength)
+    _mrj->set_defs(const_cast<char*>(fname),blength,_map_tasks);
+  else _mrj->set_defs(fname,_map_tasks);
+  _mrj->run(_nprocs,_reduce_tasks,_quiet,_output_format,nfile,_ndisp,_fout,_results);
+}
+
+void job::run_mr_job(const std::vector<std::string> &fnames, const int &nfile)
+{
+  if (!_mrj)
+    {
+      _mrj = new mr_job(fnames, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
+      _mrj->set_sample_reuse(!_resample);
+      _mrj->set_value_modifier(_value_modifier);
+      _mrj->set_order(_order,_order_limit);
+      _mrj->set_csv(_csv_quoting,_csv_separator);
+      if (_shards.size())
+	_mrj->set_output_shards(&_shards);
+      if (_columnar.is_open())
+	_mrj->set_columnar(&_columnar);
+      if (_stage.is_running())
+	_mrj->set_output_stage(&_stage);
+      _mrj->set_counter(_counter);
+    }
+  else _mrj->set_defs(fnames,_map_tasks);
   _mrj->run(_nprocs,_reduce_tasks,_quiet,_output_format,nfile,_ndisp,_fout,_results);
-  delete _mrj;
-  _mrj = nullptr;
-  mapreduce_appbase::deinitialize();
 }
 
 void job::run_mr_job_merge_results(const char *fname, const int &nfile,
 				   const bool &run_end, const size_t &blength,
-				   const bool &newfile)
+				   const checkpoint &pos, const bool &file_start,
+				   const bool &file_end, const std::string &cache_file)
 {
-  if (nfile == 0)
+  if (!_mrj)
     {
-      mapreduce_appbase::initialize();
       if (blength > 0) // from buffer
 	_mrj = new mr_job(const_cast<char*>(fname),blength, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
       else _mrj = new mr_job(fname, _map_tasks, _app_name, &_lf, _store_content, _compressed, _quiet, _skip_header);
+      _mrj->set_sample_reuse(!_resample);
+      _mrj->set_value_modifier(_value_modifier);
+      _mrj->set_order(_order,_order_limit);
+      _mrj->set_csv(_csv_quoting,_csv_separator);
+      if (_shards.size())
+	_mrj->set_output_shards(&_shards);
+      if (_columnar.is_open())
+	_mrj->set_columnar(&_columnar);
+      if (_stage.is_running())
+	_mrj->set_output_stage(&_stage);
+      _mrj->set_spill(_max_memory,_spill_dir);
+      _mrj->resume(_resumed);
     }
   else
     {
@@ -212,20 +661,149 @@ void job::run_mr_job_merge_results(const char *fname, const int &nfile,
       else _mrj->set_defs(fname,_map_tasks);
     }
   
-  _mrj->run_no_final(_nprocs,_reduce_tasks,_quiet,_output_format,nfile,_ndisp,_fout,_ofname,_tmp_save,newfile);
+  // the results of a file to cache are kept apart from the ones before
+  if (file_start)
+    {
+      _caching = !cache_file.empty() && _mrj->hold_results();
+      if (!cache_file.empty() && !_caching)
+	LOG(WARNING) << "unable to spill the results so far, not caching file=" << pos._fname;
+    }
+  _mrj->run_no_final(_nprocs,_reduce_tasks,_quiet,_output_format,nfile,_ndisp,_fout);
+  if (file_end && _caching)
+    _mrj->cache_save(pos,cache_file);
+  // the results so far are saved once the file is over
+  if (file_end && _tmp_save && !run_end)
+    _mrj->checkpoint_save(pos,_ofname + ".ckpt");
 
   if (run_end)
     {
+      _finalized = true;
+      _mrj->output_wait();
       _mrj->set_final_result();
       _mrj->reset();
-      _mrj->run_finalize(_quiet,_output_format,-1,_ndisp,_fout);
-      delete _mrj;
-      _mrj = nullptr;
-      mapreduce_appbase::deinitialize();
+      if (!_worker_out.empty())
+	{
+	  if (_mrj->write_partial(_worker_out) < 0)
+	    _failed = true;
+	}
+      else _mrj->run_finalize(_quiet,_output_format,-1,_ndisp,_fout);
     }
 }
 
+  bool job::read_cached(const std::string &cache_file, const std::string &fname)
+  {
+    struct stat st;
+    if (stat(cache_file.c_str(),&st) != 0)
+      return false;
+    checkpoint ckpt;
+    std::vector<log_record*> records;
+    if (ckpt.load(cache_file,[&records](log_record *lr){ records.push_back(lr); }) < 0)
+      {
+	for (size_t i = 0; i < records.size(); i++)
+	  delete records.at(i);
+	return false;
+      }
+    LOG(INFO) << "read " << records.size() << " records of file=" << fname << " from cache " << cache_file;
+    _resumed.insert(_resumed.end(),records.begin(),records.end());
+    if (_mrj)
+      _mrj->resume(_resumed);
+    return true;
+  }
+
+  int job::resume_checkpoint(size_t &first_file, size_t &first_offset)
+  {
+    if (!_autosplit || !_merge_results)
+      {
+	LOG(ERROR) << "resuming requires results merged over autosplit files";
+	return -1;
+      }
+    checkpoint ckpt;
+    if (ckpt.load(_resume,[this](log_record *lr){ _resumed.push_back(lr); }) < 0)
+      return -1;
+    if (ckpt._file < 0 || ckpt._file >= (int64_t)_files.size()
+	|| _files.at(ckpt._file) != ckpt._fname)
+      {
+	LOG(ERROR) << "checkpoint " << _resume << " does not match the input files, its last file being " << ckpt._fname;
+	return -1;
+      }
+    first_file = ckpt._file;
+    first_offset = ckpt._offset;
+    struct stat st;
+    if (stat(ckpt._fname.c_str(),&st) == 0 && first_offset >= (size_t)st.st_size)
+      {
+	++first_file;
+	first_offset = 0;
+      }
+    if (first_file >= _files.size())
+      {
+	LOG(ERROR) << "checkpoint " << _resume << " covers all the input files";
+	return -1;
+      }
+    LOG(INFO) << "resuming from " << _resume << " with " << _resumed.size() << " records, at byte " << first_offset << " of file=" << _files.at(first_file);
+    return 0;
+  }
+
+  void job::expand_files()
+  {
+    std::vector<std::string> files;
+    for (size_t i=0;i<_files.size();i++)
+      {
+	const std::string &f = _files.at(i);
+	struct stat st;
+	if (stat(f.c_str(),&st)==0 && S_ISDIR(st.st_mode))
+	  {
+	    // regular files of the directory, in name order
+	    std::vector<std::string> dfiles;
+	    DIR *d = opendir(f.c_str());
+	    while (d)
+	      {
+		struct dirent *e = readdir(d);
+		if (!e)
+		  break;
+		if (e->d_name[0] == '.')
+		  continue;
+		std::string df = f + "/" + e->d_name;
+		if (stat(df.c_str(),&st)==0 && S_ISREG(st.st_mode))
+		  dfiles.push_back(df);
+	      }
+	    if (d)
+	      closedir(d);
+	    std::sort(dfiles.begin(),dfiles.end());
+	    files.insert(files.end(),dfiles.begin(),dfiles.end());
+	  }
+	else if (f.find_first_of("*?[") != std::string::npos)
+	  {
+	    glob_t g;
+	    if (glob(f.c_str(),0,NULL,&g) == 0)
+	      {
+		for (size_t j=0;j<g.gl_pathc;j++)
+		  files.push_back(g.gl_pathv[j]);
+		globfree(&g);
+	      }
+	    else files.push_back(f); // reported as not found
+	  }
+	else files.push_back(f);
+      }
+    _files.swap(files);
+  }
+
     unsigned long job::get_available_memory()
+    {
+      // inside a container, the memory left to its cgroup bounds the
+      // memory of the host
+      unsigned long avail_mem = get_host_available_memory();
+      size_t limit = cgroup_memory_limit();
+      if (limit > 0)
+	{
+	  size_t usage = cgroup_memory_usage();
+	  unsigned long headroom = limit > usage ? limit - usage : 0;
+	  LOG(INFO) << "cgroup memory limit: " << limit << " -- usage: " << usage << std::endl;
+	  avail_mem = std::min(avail_mem,headroom);
+	}
+      return avail_mem;
+    }
+
+    unsigned long job::get_host_available_memory()
     {
       size_t avail_mem;
 
@@ -272,15 +850,20 @@ void job::run_mr_job_merge_results(const char *fname, const int &nfile,
   {
     if (_nchunks_split == 0)
       {
+	// the memory factor measured by sampling the previous chunks, unless set
+	if (_calibrate_memory && _mrj && _mrj->_sampled_factor > 0.0)
+	  _in_memory_factor = _mrj->_sampled_factor;
 	unsigned long ms = get_available_memory();
-	LOG(INFO) << "available memory: " << ms << " -- file size: " << fs << std::endl;
+	if (_max_memory > 0)
+	  ms = std::min(ms,(unsigned long)_max_memory / 2);
+	LOG(INFO) << "available memory: " << ms << " -- file size: " << fs << " -- memory factor: " << _in_memory_factor << std::endl;
 	/*if (fs < ms)
 	  {
 	    std::cerr << "autosplit not needed\n";
 	    mfsize = ms;
 	    return false;
 	    }*/
-	nchunks = static_cast<unsigned long>(ceil(fs / ((1.0/_in_memory_factor)*ms)));
+	nchunks = static_cast<unsigned long>(ceil(fs / std::max((1.0/_in_memory_factor)*ms,(double)min_chunk_size)));
       }
     else nchunks = _nchunks_split;
     mfsize = (size_t)ceil(fs / (double)nchunks);
@@ -31,6 +31,8 @@
 
 #include "log_format.h"
 #include "mr_job.h"
+#include "file_cache.h"
+#include "compressed_input.h"
 #include <fstream>
 
 //#define DEFAULT_NDISP 10
@@ -54,10 +56,13 @@ namespace miw
 	      (*_results)[i].reset();
 	    _results->shallow_free();
 	  }
+	for (size_t i = 0; i < _resumed.size(); ++i)
+	  delete _resumed[i];
       }
 
     // memory management
     unsigned long get_available_memory();
+    unsigned long get_host_available_memory();
 
     // input management
     bool file_size_autosplit(const size_t &fs,
@@ -67,14 +72,35 @@ namespace miw
     int execute();
     int execute(int argc, char *argv[]);
 
+    void expand_files();
     void run_mr_job(const char *fname, const int &nfile, const size_t &blength=0);
-    void run_mr_job_merge_results(const char *fname, const int &nfile, const bool &run_end, const size_t &blength=0, const bool &newfile=true);
+    void run_mr_job(const std::vector<std::string> &fnames, const int &nfile);
+    void run_mr_job_merge_results(const char *fname, const int &nfile, const bool &run_end, const size_t &blength,
+				  const checkpoint &pos, const bool &file_start, const bool &file_end,
+				  const std::string &cache_file);
+
+    // reads the cached results of a file, merged into the next run.
+    bool read_cached(const std::string &cache_file, const std::string &fname);
+
+    // processes a compressed file as blocks of whole lines, decompressed
+    // ahead of the runs. -1 on error.
+    int run_compressed(const std::string &fname, const size_t &nfile, const struct stat &st);
+
+    // runs the workers over ranges of the input, and merges their
+    // partial results into the output.
+    int run_coordinator();
+
+    // loads the checkpoint to resume from, and where its input ends.
+    int resume_checkpoint(size_t &first_file, size_t &first_offset);
 
     void glog_init(char *argv[]);
     
     long _skipped_logs = 0;
     log_format _lf;
     std::ofstream _fout; /**< output file stream */
+    output_shards _shards; /**< output files written by the reduce tasks */
+    columnar_file _columnar; /**< columnar output file */
+    output_stage _stage; /**< output of the runs, pipelined with the next ones */
     
     // options
     std::string _app_name;
@@ -83,17 +109,42 @@ namespace miw
     bool _autosplit = false; // whether to split input files based on heuristic of memory-usage.
     bool _merge_results = false; // whether to merge results over multiple inputop
     int _nchunks_split = 0;
+    enum { min_chunk_size = 65536 }; // smallest autosplit chunk, in bytes
+    enum { compressed_ratio = 8 }; // expected decompressed size of a compressed file, per byte
+    size_t _max_memory = 0; // memory budget in bytes, 0 for none.
+    std::string _spill_dir; // directory of the spilled results, TMPDIR when empty.
+    bool _calibrate_memory = false; // whether the memory factor comes from sampling.
     double _in_memory_factor = 10; // we expect to use at max 10 times more memory than log volume, for processing them. Very conservative value, used in auto-splitting the log files before processing them.
-    std::string _output_format; // other values: json, csv
+    std::string _output_format; // other values: json, csv, columnar
     bool _quiet = false;
     bool _skip_header = false; // whether to skip the first file line
-    bool _tmp_save = false; // ability to save temporary results
+    bool _tmp_save = false; // whether to checkpoint the merged results after each file
+    std::string _resume; // checkpoint to resume from, empty for none
+    std::vector<log_record*> _resumed; // its records and the cached ones, until the mr job takes them
+    file_cache _cache; // merged results of single files
+    bool _caching = false; // whether the results of the current file go to the cache
+    bool _finalized = false; // whether the merged results were output
+    bool _resample = false; // whether to sample each input file
+    bool _value_modifier = false; // whether to merge records in place as they are emitted
+    bool _counter = false; // whether the format only counts logs per key
+    std::string _order = "none"; // output order: none, key, count or aggregated field name
+    int _order_limit = 0; // number of leading output records to order, 0 for all
+    std::string _csv_quoting = "strings"; // CSV quoting: strings, minimal or all
+    std::string _csv_separator = ","; // CSV separator character
     
     int _nprocs = 0; /**< number of used processors, when specified */
     int _map_tasks = 0; /**< number of map tasks, when specified */
     int _reduce_tasks = 0; /**< number of reduce tasks, when specified */
     int _ndisp = 0; /**< number of top entries to show */
+    int _output_cores = 0; /**< cores of the pipelined output stage, 0 for none */
     std::string _format_name;
+    int _workers = 0; /**< worker processes of the coordinator, 0 for none */
+    std::string _worker_template; /**< command line of a worker */
+    std::string _worker_out; /**< partial results file of a worker, empty for the output */
+    size_t _first_offset = 0; /**< range of a worker, in its first and last files */
+    size_t _last_offset = 0;
+    std::vector<std::string> _args; /**< command line arguments, passed on to the workers */
+    bool _failed = false; /**< whether the results could not be written */
     
     // map reduce inner job object
     mr_job *_mrj = nullptr;
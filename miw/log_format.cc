@@ -274,230 +274,8 @@ namespace miw
 	std::remove_copy(token.begin(),token.end(),std::back_inserter(ntoken),'"');
 	token = ntoken;
 
-	// field string matching: key is a 'and', other fields can be 'or' conditions
-	if (f->has_match())
-	  {
-	    std::unordered_set<std::string> *matches_str;
-	    
-	    // read match_file once if any
-	    if (!f->mutable_match()->match_file().empty())
-	      {
-		matches_str = new std::unordered_set<std::string>();
-		std::unordered_map<std::string,std::unordered_set<std::string>*>::const_iterator muit;
-		std::lock_guard<std::mutex> lock(_loading_match_file_mutex);
-		if ((muit=_match_file_fields.find(f->name()))==_match_file_fields.end())
-		  {
-		    std::ifstream infile(f->mutable_match()->match_file());
-		    if (!infile.is_open())
-		      {
-			LOG(FATAL) << "Failed opening match file " << f->mutable_match()->match_file() << std::endl;
-		      }
-		    LOG(INFO) << "Reading file " << f->mutable_match()->match_file()
-			      << " for field " << f->name() << std::endl;
-		    std::string mstr;
-		    while (infile >> mstr)
-		      {
-			matches_str->insert(mstr);
-		      }
-		    matches_str->rehash(matches_str->size());
-		    _match_file_fields.insert(std::make_pair(f->name(),matches_str));
-		    _ldef.mutable_fields(i)->mutable_match()->set_match_file("");
-		    LOG(INFO) << "Done reading " << matches_str->size() << " line in file " << f->mutable_match()->match_file() << std::endl;
-		  }
-		else
-		  {
-		    matches_str = (*muit).second;
-		  }
-	      }
-	    else
-	      {
-		matches_str = new std::unordered_set<std::string>();
-		std::unordered_map<std::string,std::unordered_set<std::string>*>::const_iterator muit;
-		if ((muit=_match_file_fields.find(f->name()))==_match_file_fields.end())
-		  {
-		    matches_str->insert(f->mutable_match()->match_str());
-		    _match_file_fields.insert(std::make_pair(f->name(),matches_str));
-		  }
-		else
-		  {
-		    matches_str = (*muit).second;
-		  }
-	      }
-
-	    bool negative = f->mutable_match()->negative();
-	    if (!negative) // matching means keeping
-	      {
-		std::unordered_set<std::string>::const_iterator uit = matches_str->begin();
-		if ((uit=matches_str->find(token))!=matches_str->end())
-		  {
-		    if (f->mutable_match()->logic() == "or")
-		      match = true; // has match specified, if no 'or' match condition kicks in, the data entry should be later killed
-		    uit = matches_str->end();
-		  }
-		else if (f->mutable_match()->exact())
-		  return NULL;
-
-		// reverse linear-time lookup if not exact matching
-		if (!f->mutable_match()->exact())
-		  {
-		    uit=matches_str->begin();
-		    while(uit!=matches_str->end())
-		      {
-			if (token.find((*uit))==std::string::npos)
-			  {
-			    if (f->key() || f->mutable_match()->logic() == "and") {
-			      return NULL;
-			    }
-			    else if (f->mutable_match()->logic() == "or") {
-			      match = true; // has match specified, if no 'or' match condition kicks in, the data entry should be later killed
-			    }
-			    break;
-			  }
-			else
-			  {
-			    if (f->mutable_match()->logic() == "or")
-			      {
-				match = true;
-				has_or_match = true;
-				break;
-			      }
-			  }
-			++uit;
-		      }
-		  }
-	      }
-	    else  // matching means killing
-	      {
-		std::unordered_set<std::string>::const_iterator uit;// = matches_str.begin();
-		if ((uit=matches_str->find(token))!=matches_str->end())
-		  {
-		    if (f->key() || f->mutable_match()->logic() == "and")
-		      return NULL;
-		    else if (f->mutable_match()->logic() == "or")
-		      match = true; // has match specified, if no 'or' match condition kicks in, the data entry should be later killed
-		    uit = matches_str->end();
-		  }
-
-		
-		// reverse linear-time lookup if not exact matching
-		if (!f->mutable_match()->exact())
-		  {
-		    uit=matches_str->begin();
-		    while(uit!=matches_str->end())
-		      {
-			if (token.find((*uit))!=std::string::npos)
-			  {
-			    if (f->key() || f->mutable_match()->logic() == "and") {
-			      return NULL;
-			    }
-			    else break;
-			  }
-			++uit;
-		      }
-		  }
-	      }
-	  }
-
-	if (ftype == "date" || f->processing() == "day" || f->processing() == "month" || f->processing() == "year")
-	  {
-	    struct tm tm;
-	    bool datef_ok = false;
-	    if (f->date_format() == "unix")
-	      {
-		time_t ut = std::stoi(token);
-		gmtime_r(&ut,&tm);
-		datef_ok = true;
-	      }
-	    else
-	      {
-		if (strptime(token.c_str(),f->date_format().c_str(),&tm) != NULL)
-		  datef_ok = true;
-	      }
-
-	    if (datef_ok)
-	      {
-		if (f->processing() == "day")
-		  {
-		    token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday);
-		  }
-		else if (f->processing() == "month")
-		  token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1);
-		else if (f->processing() == "year")
-		  token = std::to_string(tm.tm_year+1900);
-		else if (f->processing() == "hour")
-		  {
-		    token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday) + "T" + std::to_string(tm.tm_hour) + ":00:00";
-		  }
-		else if (f->processing() == "minute")
-		  {
-		    int m = tm.tm_min / f->processing_offset();
-		    m *= f->processing_offset();
-		    std::string mins_token = (m < 10 ? "0" : "") + std::to_string(m);
-		    token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday) + "T" + std::to_string(tm.tm_hour) + ":" + mins_token + ":00";
-		  }
-		else if (f->processing() == "second")
-		  {
-		    token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday) + "T" + std::to_string(tm.tm_hour) + ":" + std::to_string(tm.tm_min) + ":" + std::to_string(tm.tm_sec);
-		  }
-	      }
-	    else LOG(WARNING) << "Warning: unrecognized date format " << token << std::endl;
-	  }
-	else if (f->processing() == "hour" || f->processing() == "minute" || f->processing() == "second")
-	  {
-	    token = chomp_cpp(token);
-	    std::vector <std::string> elts;
-	    log_format::tokenize(token,-1,elts,":",""); // XXX: very basic tokenization of time fields of the form 14:39:02.
-	    if (elts.size() == 3)
-	      {
-		if (f->processing() == "hour")
-		  {
-		    int h = std::stoi(elts.at(0)) / f->processing_offset();
-		    h *= f->processing_offset();
-		    token = (h < 10 ? "0" : "") + std::to_string(h);
-		  }
-		else if (f->processing() == "minute")
-		  {
-		    int m = std::stoi(elts.at(1)) / f->processing_offset();
-		    m *= f->processing_offset();
-		    token = elts.at(0) + ":" + (m < 10 ? "0" : "") + std::to_string(m);
-		  }
-		else if (f->processing() == "second")
-		  {
-		    int s = std::stoi(elts.at(2)) / f->processing_offset();
-		    s *= f->processing_offset();
-		    token = elts.at(0) + ":" + elts.at(1) + ":" + (s < 10 ? "0" : "") + std::to_string(s);
-		  }
-	      }
-	    else LOG(WARNING) << "Warning: unrecognized time format " << token << std::endl;
-	  }
-	else if (ftype == "url")
-	  {
-	    // - parse field value into tokens
-	    if (token.find("://[")==std::string::npos) // XXX: cppnetlib hangs on such URIs, possibly a consequence of the not working is_valid() call at the moment
-	      {
-		uri::uri uri_token(token);
-		/*if (!uri_token.is_valid()) // validity appears to not be qualifiying urls properly, cppnetlib bug ?
-		  {
-		  LOG(WARNING) << "invalid URL " << token << std::endl;
-		  continue;
-		  }*/
-
-		// fill out format with tokens
-		if (!uri_token.scheme().empty())
-		  {
-		    std::string nuri = f->url_format();
-		    str_utils::replace_in_string(nuri,"%scheme",uri_token.scheme());
-		    str_utils::replace_in_string(nuri,"%host",uri_token.host());
-		    if (!uri_token.port().empty())
-		      str_utils::replace_in_string(nuri,"%port",":"+uri_token.port());
-		    else str_utils::replace_in_string(nuri,"%port","");
-		    str_utils::replace_in_string(nuri,"%path",uri_token.path());
-		    str_utils::replace_in_string(nuri,"%query",uri_token.query());
-		    str_utils::replace_in_string(nuri,"%fragment",uri_token.fragment());
-		    token = nuri;
-		  }
-	      }
-	  }
+	if (!process_token(i,f,token,match,has_or_match))
+	  return NULL;
 
 	// apply preprocessing (or not) to field according to type.
 	if (ftype == "int")
@@ -603,6 +381,328 @@ namespace miw
     return lr;
   }
 
+  bool log_format::parse_key(const std::string &line,
+			     const std::string &appname,
+			     std::string &key)
+  {
+    if (chomp_cpp(line).empty())
+      return false;
+    std::vector<std::string> tokens;
+    log_format::tokenize(line,-1,tokens,_ldef.delims(),_ldef.quotechar());
+
+    // same walk over the fields as parse_line, without filling a logdef.
+    int pos = -1;
+    bool match = false;
+    bool has_or_match = false;
+    key.clear();
+    for (int i=0;i<_ldef.fields_size();i++)
+      {
+	field *f = _ldef.mutable_fields(i);
+	int fpos = f->pos();
+	if (fpos == -1)
+	  fpos = ++pos;
+	else if (f->aggregation() == "ratio")
+	  pos = fpos;
+
+	if (fpos >= (int)tokens.size())
+	  {
+	    LOG(ERROR) << "Error: token position " << fpos << " is beyond the number of log fields. Skipping line: " << line << std::endl;
+	    return false;
+	  }
+	else if (f->filter_type() == "contain" || (!f->key() && !f->has_match()))
+	  continue;
+
+	std::string token;
+	const std::string &rtoken = tokens.at(fpos);
+	std::remove_copy(rtoken.begin(),rtoken.end(),std::back_inserter(token),'"');
+	if (!process_token(i,f,token,match,has_or_match))
+	  return false;
+
+	if (f->key())
+	  {
+	    if (f->type() != "int" && f->type() != "bool" && f->type() != "float")
+	      token = chomp_cpp(token);
+	    if (!key.empty())
+	      key += "_";
+	    key += token;
+	  }
+      }
+    if (match && !has_or_match)
+      return false;
+    if (!appname.empty())
+      key += "_" + appname;
+    return true;
+  }
+
+  bool log_format::count_only() const
+  {
+    for (int i=0;i<_ldef.fields_size();i++)
+      {
+	const field &f = _ldef.fields(i);
+	if (f.aggregated() && !(f.key() && f.aggregation() == "union"))
+	  return false;
+	if (!f.filter().empty() || !f.filter_type().empty() || !f.preprocessing().empty())
+	  return false;
+      }
+    return true;
+  }
+
+  bool log_format::output_columns(const std::string &appname,
+				  std::vector<std::string> &columns) const
+  {
+    columns = { "id", "logs", "format_name", "std_date_dt" };
+    if (!appname.empty())
+      columns.push_back("appname");
+    for (int i=0;i<_ldef.fields_size();i++)
+      {
+	const field &f = _ldef.fields(i);
+	if (!f.preprocessing().empty())
+	  return false;
+	columns.push_back(f.name());
+	if (f.aggregated() && (f.aggregation() == "union_count" || f.aggregation() == "count"))
+	  columns.push_back(f.name() + "_count");
+      }
+    std::sort(columns.begin(),columns.end());
+    columns.erase(std::unique(columns.begin(),columns.end()),columns.end());
+    return true;
+  }
+
+  bool log_format::process_token(const int &i,
+				 field *f,
+				 std::string &token,
+				 bool &match,
+				 bool &has_or_match)
+  {
+    std::string ftype = f->type();
+
+    // field string matching: key is a 'and', other fields can be 'or' conditions
+    if (f->has_match())
+      {
+	std::unordered_set<std::string> *matches_str;
+
+	// read match_file once if any
+	if (!f->mutable_match()->match_file().empty())
+	  {
+	    std::unordered_map<std::string,std::unordered_set<std::string>*>::const_iterator muit;
+	    std::lock_guard<std::mutex> lock(_loading_match_file_mutex);
+	    if ((muit=_match_file_fields.find(f->name()))==_match_file_fields.end())
+	      {
+		matches_str = new std::unordered_set<std::string>();
+		std::ifstream infile(f->mutable_match()->match_file());
+		if (!infile.is_open())
+		  {
+		    LOG(FATAL) << "Failed opening match file " << f->mutable_match()->match_file() << std::endl;
+		  }
+		LOG(INFO) << "Reading file " << f->mutable_match()->match_file()
+			  << " for field " << f->name() << std::endl;
+		std::string mstr;
+		while (infile >> mstr)
+		  {
+		    matches_str->insert(mstr);
+		  }
+		matches_str->rehash(matches_str->size());
+		_match_file_fields.insert(std::make_pair(f->name(),matches_str));
+		_ldef.mutable_fields(i)->mutable_match()->set_match_file("");
+		LOG(INFO) << "Done reading " << matches_str->size() << " line in file " << f->mutable_match()->match_file() << std::endl;
+	      }
+	    else
+	      {
+		matches_str = (*muit).second;
+	      }
+	  }
+	else
+	  {
+	    std::unordered_map<std::string,std::unordered_set<std::string>*>::const_iterator muit;
+	    std::lock_guard<std::mutex> lock(_loading_match_file_mutex);
+	    if ((muit=_match_file_fields.find(f->name()))==_match_file_fields.end())
+	      {
+		matches_str = new std::unordered_set<std::string>();
+		matches_str->insert(f->mutable_match()->match_str());
+		_match_file_fields.insert(std::make_pair(f->name(),matches_str));
+	      }
+	    else
+	      {
+		matches_str = (*muit).second;
+	      }
+	  }
+
+	bool negative = f->mutable_match()->negative();
+	if (!negative) // matching means keeping
+	  {
+	    std::unordered_set<std::string>::const_iterator uit = matches_str->begin();
+	    if ((uit=matches_str->find(token))!=matches_str->end())
+	      {
+		if (f->mutable_match()->logic() == "or")
+		  match = true; // has match specified, if no 'or' match condition kicks in, the data entry should be later killed
+		uit = matches_str->end();
+	      }
+	    else if (f->mutable_match()->exact())
+	      return false;
+
+	    // reverse linear-time lookup if not exact matching
+	    if (!f->mutable_match()->exact())
+	      {
+		uit=matches_str->begin();
+		while(uit!=matches_str->end())
+		  {
+		    if (token.find((*uit))==std::string::npos)
+		      {
+			if (f->key() || f->mutable_match()->logic() == "and") {
+			  return false;
+			}
+			else if (f->mutable_match()->logic() == "or") {
+			  match = true; // has match specified, if no 'or' match condition kicks in, the data entry should be later killed
+			}
+			break;
+		      }
+		    else
+		      {
+			if (f->mutable_match()->logic() == "or")
+			  {
+			    match = true;
+			    has_or_match = true;
+			    break;
+			  }
+		      }
+		    ++uit;
+		  }
+	      }
+	  }
+	else  // matching means killing
+	  {
+	    std::unordered_set<std::string>::const_iterator uit;// = matches_str.begin();
+	    if ((uit=matches_str->find(token))!=matches_str->end())
+	      {
+		if (f->key() || f->mutable_match()->logic() == "and")
+		  return false;
+		else if (f->mutable_match()->logic() == "or")
+		  match = true; // has match specified, if no 'or' match condition kicks in, the data entry should be later killed
+		uit = matches_str->end();
+	      }
+
+
+	    // reverse linear-time lookup if not exact matching
+	    if (!f->mutable_match()->exact())
+	      {
+		uit=matches_str->begin();
+		while(uit!=matches_str->end())
+		  {
+		    if (token.find((*uit))!=std::string::npos)
+		      {
+			if (f->key() || f->mutable_match()->logic() == "and") {
+			  return false;
+			}
+			else break;
+		      }
+		    ++uit;
+		  }
+	      }
+	  }
+      }
+
+    if (ftype == "date" || f->processing() == "day" || f->processing() == "month" || f->processing() == "year")
+      {
+	struct tm tm;
+	bool datef_ok = false;
+	if (f->date_format() == "unix")
+	  {
+	    time_t ut = std::stoi(token);
+	    gmtime_r(&ut,&tm);
+	    datef_ok = true;
+	  }
+	else
+	  {
+	    if (strptime(token.c_str(),f->date_format().c_str(),&tm) != NULL)
+	      datef_ok = true;
+	  }
+
+	if (datef_ok)
+	  {
+	    if (f->processing() == "day")
+	      {
+		token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday);
+	      }
+	    else if (f->processing() == "month")
+	      token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1);
+	    else if (f->processing() == "year")
+	      token = std::to_string(tm.tm_year+1900);
+	    else if (f->processing() == "hour")
+	      {
+		token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday) + "T" + std::to_string(tm.tm_hour) + ":00:00";
+	      }
+	    else if (f->processing() == "minute")
+	      {
+		int m = tm.tm_min / f->processing_offset();
+		m *= f->processing_offset();
+		std::string mins_token = (m < 10 ? "0" : "") + std::to_string(m);
+		token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday) + "T" + std::to_string(tm.tm_hour) + ":" + mins_token + ":00";
+	      }
+	    else if (f->processing() == "second")
+	      {
+		token = std::to_string(tm.tm_year+1900) + "-" + std::to_string(tm.tm_mon+1) + "-" + std::to_string(tm.tm_mday) + "T" + std::to_string(tm.tm_hour) + ":" + std::to_string(tm.tm_min) + ":" + std::to_string(tm.tm_sec);
+	      }
+	  }
+	else LOG(WARNING) << "Warning: unrecognized date format " << token << std::endl;
+      }
+    else if (f->processing() == "hour" || f->processing() == "minute" || f->processing() == "second")
+      {
+	token = chomp_cpp(token);
+	std::vector <std::string> elts;
+	log_format::tokenize(token,-1,elts,":",""); // XXX: very basic tokenization of time fields of the form 14:39:02.
+	if (elts.size() == 3)
+	  {
+	    if (f->processing() == "hour")
+	      {
+		int h = std::stoi(elts.at(0)) / f->processing_offset();
+		h *= f->processing_offset();
+		token = (h < 10 ? "0" : "") + std::to_string(h);
+	      }
+	    else if (f->processing() == "minute")
+	      {
+		int m = std::stoi(elts.at(1)) / f->processing_offset();
+		m *= f->processing_offset();
+		token = elts.at(0) + ":" + (m < 10 ? "0" : "") + std::to_string(m);
+	      }
+	    else if (f->processing() == "second")
+	      {
+		int s = std::stoi(elts.at(2)) / f->processing_offset();
+		s *= f->processing_offset();
+		token = elts.at(0) + ":" + elts.at(1) + ":" + (s < 10 ? "0" : "") + std::to_string(s);
+	      }
+	  }
+	else LOG(WARNING) << "Warning: unrecognized time format " << token << std::endl;
+      }
+    else if (ftype == "url")
+      {
+	// - parse field value into tokens
+	if (token.find("://[")==std::string::npos) // XXX: cppnetlib hangs on such URIs, possibly a consequence of the not working is_valid() call at the moment
+	  {
+	    uri::uri uri_token(token);
+	    /*if (!uri_token.is_valid()) // validity appears to not be qualifiying urls properly, cppnetlib bug ?
+	      {
+	      LOG(WARNING) << "invalid URL " << token << std::endl;
+	      continue;
+	      }*/
+
+	    // fill out format with tokens
+	    if (!uri_token.scheme().empty())
+	      {
+		std::string nuri = f->url_format();
+		str_utils::replace_in_string(nuri,"%scheme",uri_token.scheme());
+		str_utils::replace_in_string(nuri,"%host",uri_token.host());
+		if (!uri_token.port().empty())
+		  str_utils::replace_in_string(nuri,"%port",":"+uri_token.port());
+		else str_utils::replace_in_string(nuri,"%port","");
+		str_utils::replace_in_string(nuri,"%path",uri_token.path());
+		str_utils::replace_in_string(nuri,"%query",uri_token.query());
+		str_utils::replace_in_string(nuri,"%fragment",uri_token.fragment());
+		token = nuri;
+	      }
+	  }
+      }
+    return true;
+  }
+
   int log_format::pre_process_evtxcsv(field *f,
 				      const std::string &token,
 				      std::vector<field*> &nfields) const
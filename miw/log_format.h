@@ -86,6 +86,28 @@ namespace miw
 			   const bool &quiet,
 			   int &skipped_logs);
 
+    // key of a line as parse_line would build it, with the same match
+    // filtering, but without creating the record. false if the line is dropped.
+    bool parse_key(const std::string &line,
+		   const std::string &appname,
+		   std::string &key);
+
+    // whether records only aggregate their count: no aggregated field other
+    // than unions on key fields, no filter and no pre-processing.
+    bool count_only() const;
+
+    // keys of the output records, in order, for a fixed CSV header. false
+    // when a pre-processing generates fields from the lines.
+    bool output_columns(const std::string &appname,
+			std::vector<std::string> &columns) const;
+
+    // match conditions and processing of a field's token, false if the line is dropped.
+    bool process_token(const int &i,
+		       field *f,
+		       std::string &token,
+		       bool &match,
+		       bool &has_or_match);
+
     // custom pre-processing.
     int pre_process_evtxcsv(field *f,
 			    const std::string &token,
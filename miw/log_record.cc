@@ -33,7 +33,8 @@
 #include <iostream>
 #include <snappy.h>
 #include <assert.h>
-#include "str_utils.h"
+#include <string.h>
+#include <stdint.h>
 #include <glog/logging.h>
 
 namespace miw
@@ -334,6 +335,118 @@ namespace miw
       }
   }
   
+  void log_record::flatten_unions()
+  {
+    auto hit = _unos.begin();
+    while(hit!=_unos.end())
+      {
+	field *f = _ld.mutable_fields((*hit).first);
+	if (!(*hit).second.empty() && f->type() != "date") // dates are not output from the cache
+	  {
+	    string_field *ifs = f->mutable_str_fi();
+	    ifs->clear_str_reap();
+	    for (size_t l=0;l<(*hit).second.size();l++)
+	      ifs->add_str_reap("");
+	    auto rhit = (*hit).second.begin();
+	    while(rhit!=(*hit).second.end())
+	      {
+		ifs->set_str_reap((*rhit).second,(*rhit).first);
+		++rhit;
+	      }
+	  }
+	++hit;
+      }
+    _unos.clear();
+  }
+
+  namespace
+  {
+    void append_u32(std::string &out, const uint32_t &v)
+    {
+      out.append((const char*)&v,sizeof(v));
+    }
+
+    void append_str(std::string &out, const std::string &str)
+    {
+      append_u32(out,str.length());
+      out.append(str);
+    }
+
+    bool read_u32(const char *&p, const char *end, uint32_t &v)
+    {
+      if (end - p < (long)sizeof(v))
+	return false;
+      memcpy(&v,p,sizeof(v));
+      p += sizeof(v);
+      return true;
+    }
+
+    bool read_str(const char *&p, const char *end, std::string &str)
+    {
+      uint32_t len = 0;
+      if (!read_u32(p,end,len) || end - p < (long)len)
+	return false;
+      str.assign(p,len);
+      p += len;
+      return true;
+    }
+  }
+
+  void log_record::serialize(std::string &out)
+  {
+    // key | sum | logdef | flags and sizes | lines | compressed lines,
+    // strings prefixed by their uint32 length
+    flatten_unions();
+    append_str(out,_key);
+    int64_t sum = _sum;
+    out.append((const char*)&sum,sizeof(sum));
+    append_str(out,_ld.SerializeAsString());
+    append_u32(out,_compressed);
+    append_u32(out,_compressed_size);
+    append_u32(out,_original_size);
+    append_u32(out,_lines.size());
+    for (size_t i=0;i<_lines.size();i++)
+      append_str(out,_lines.at(i));
+    append_str(out,_compressed_lines);
+  }
+
+  log_record* log_record::unserialize(const char *buf, const size_t &len)
+  {
+    const char *p = buf, *end = buf + len;
+    std::string key,ld;
+    int64_t sum = 0;
+    if (!read_str(p,end,key) || end - p < (long)sizeof(sum))
+      return nullptr;
+    memcpy(&sum,p,sizeof(sum));
+    p += sizeof(sum);
+    log_record *lr = new log_record(key,logdef());
+    uint32_t compressed = 0, compressed_size = 0, original_size = 0, nlines = 0;
+    if (!read_str(p,end,ld) || !lr->_ld.ParseFromString(ld)
+	|| !read_u32(p,end,compressed) || !read_u32(p,end,compressed_size)
+	|| !read_u32(p,end,original_size) || !read_u32(p,end,nlines))
+      {
+	delete lr;
+	return nullptr;
+      }
+    lr->_sum = sum;
+    lr->_compressed = compressed;
+    lr->_compressed_size = compressed_size;
+    lr->_original_size = original_size;
+    lr->_lines.resize(nlines);
+    for (uint32_t i=0;i<nlines;i++)
+      if (!read_str(p,end,lr->_lines.at(i)))
+	{
+	  delete lr;
+	  return nullptr;
+	}
+    if (!read_str(p,end,lr->_compressed_lines))
+      {
+	delete lr;
+	return nullptr;
+      }
+    return lr;
+  }
+
   /*void log_record::compress_lines()
   {
     if (!_lines.empty())
@@ -678,70 +791,236 @@ namespace miw
     //debug
   }
 
-  void log_record::json_to_csv(const Json::Value &jl,
-			       std::string &csvline,
-			       const bool &header)
+  bool log_record::write(record_writer &w)
   {
-    static std::string separator = ",";
-    std::stringstream sts,stshead;
-    for (Json::ValueConstIterator itr = jl.begin();itr!=jl.end();itr++)
+    std::string date = "0000-00-00", time = "00:00:00";
+    w.key("id");
+    w.value_string(_key);
+    for  (int i=0;i<_ld.fields_size();i++)
       {
-	std::string key = itr.key().asString();
-	if (itr != jl.begin())
+	std::string ldate,ltime;
+	if (!write(w,_ld.fields(i),i,ldate,ltime))
+	  return false;
+	if (!ldate.empty())
+	  date = ldate;
+	else if (!ltime.empty())
+	  time = ltime;
+      }
+    if (!_ld.appname().empty())
+      {
+	w.key("appname");
+	w.value_string(_ld.appname());
+      }
+    w.key("logs");
+    w.value_int(static_cast<int>(_sum));
+    w.key("format_name");
+    w.value_string(_ld.format_name());
+    w.key("std_date_dt");
+    w.value_string((date.find("T")!=std::string::npos) ? date + "Z" : date + "T" + time + "Z");
+    return true;
+  }
+
+  bool log_record::write(record_writer &w, const field &f, const int &i,
+			 std::string &date, std::string &time)
+  {
+    if (!f.preprocessing().empty())
+      return true;
+    // the values of to_json(field): the field's value (jsf), its counts
+    // (jsfc) and its holder (jsfh).
+    enum { none, scalar, array };
+    const std::string &ftype = f.type();
+    int jsf = none, jsfc = none;
+    bool jsfh = false;
+    std::vector<const std::string*> strs;
+    if (ftype == "int")
+      {
+	const int_field &ifi = f.int_fi();
+	jsf = ifi.int_reap_size() > 1 ? array : ifi.int_reap_size() == 1 ? scalar : none;
+	jsfh = ifi.holder() != 0;
+      }
+    else if (ftype == "string" || ftype == "time" || ftype == "url" || ftype == "date")
+      {
+	const string_field &ifs = f.str_fi();
+	std::unordered_map<int,std::unordered_map<std::string,int>>::const_iterator hit;
+	if (ftype != "date" && (hit=_unos.find(i))!=_unos.end() && !(*hit).second.empty())
 	  {
-	    sts << separator;
-	    if (header)
-	      stshead << separator;
+	    strs.resize((*hit).second.size(),nullptr);
+	    for (auto rhit = (*hit).second.begin();rhit!=(*hit).second.end();++rhit)
+	      strs[(*rhit).second] = &(*rhit).first;
 	  }
-	if (header)
-	  stshead << key;
-	Json::Value val = (*itr);
-	if (key == "logs")
+	else
+	  for (int j=0;j<ifs.str_reap_size();j++)
+	    strs.push_back(&ifs.str_reap(j));
+	jsf = strs.size() > 1 ? array : strs.size() == 1 ? scalar : none;
+	if (strs.size() > 1)
+	  jsfc = ifs.str_count_size() > 0 ? array : none;
+	else if (strs.size() == 1)
 	  {
-	    sts << val.asInt();
+	    if (ftype != "date")
+	      jsfc = scalar;
+	    if (ftype == "time")
+	      {
+		time = *strs[0];
+		if (f.processing() == "hour")
+		  time += ":00:00";
+		else if (f.processing() == "minute")
+		  time += ":00";
+	      }
+	    else if (ftype == "date")
+	      date = *strs[0];
 	  }
+      }
+    else if (ftype == "bool")
+      jsf = f.bool_fi().bool_reap_size() > 0 ? array : none;
+    else if (ftype == "float")
+      {
+	const float_field &iff = f.real_fi();
+	jsf = iff.float_reap_size() > 1 ? array : iff.float_reap_size() == 1 ? scalar : none;
+	jsfh = iff.holder() != 0;
+      }
+    for (size_t j=0;j<strs.size();j++)
+      if (!strs[j])
+	return false;
+
+    auto write_jsf = [&]()
+      {
+	if (jsf == array)
+	  w.begin_array();
+	if (ftype == "int")
+	  for (int j=0;j<f.int_fi().int_reap_size();j++)
+	    w.value_int(f.int_fi().int_reap(j));
+	else if (ftype == "float")
+	  for (int j=0;j<f.real_fi().float_reap_size();j++)
+	    w.value_double(f.real_fi().float_reap(j));
+	else if (ftype == "bool")
+	  for (int j=0;j<f.bool_fi().bool_reap_size();j++)
+	    w.value_bool(f.bool_fi().bool_reap(j));
 	else
+	  for (size_t j=0;j<strs.size();j++)
+	    w.value_string(*strs[j]);
+	if (jsf == array)
+	  w.end_array();
+      };
+    auto write_jsfh = [&]()
+      {
+	if (ftype == "int")
+	  w.value_int(f.int_fi().holder());
+	else w.value_double(f.real_fi().holder());
+      };
+    auto holder = [&]()
+      {
+	return ftype == "int" ? static_cast<double>(f.int_fi().holder()) : f.real_fi().holder();
+      };
+    auto reap = [&](const int &j)
+      {
+	return ftype == "int" ? static_cast<double>(f.int_fi().int_reap(j)) : f.real_fi().float_reap(j);
+      };
+    
+    if (jsf != none)
+      {
+	const std::string &aggregation = f.aggregation();
+	if (!f.aggregated())
 	  {
-	    if (val.isString())
-	      sts << "\"" << val.asString() << "\"";
-	    else if (val.isInt())
-	      sts << val.asInt();
-	    else if (val.isDouble())
-	      sts << val.asDouble();
-	    else if (val.isBool())
-	      sts << val.asBool();
-	    else if (val.isArray())
+	    w.key(f.name());
+	    write_jsf();
+	  }
+	else if (aggregation == "union")
+	  {
+	    w.key(f.name());
+	    write_jsf();
+	  }
+	else if (aggregation == "union_count")
+	  {
+	    w.key(f.name());
+	    write_jsf();
+	    w.key(f.name() + "_count");
+	    const string_field &ifs = f.str_fi();
+	    if (jsfc == array)
 	      {
-		sts << "\"[";
-		int i = 0;
-		for (const Json::Value &va : val)
-		  {
-		    if (i != 0)
-		      sts << separator;
-		    else i++;
-		    if (va.isString())
-		      {
-			//sts << "\\\"" << va.asString() << "\\\"";
-			std::string vastr = va.asString();
-			if (vastr.find(separator)!=std::string::npos)
-			  str_utils::replace_in_string(vastr,separator,"");
-			sts << vastr;
-		      }
-		    else if (va.isInt())
-		      sts << va.asInt();
-		    else if (va.isDouble())
-		      sts << va.asDouble();
-		    else if (va.isBool())
-		      sts << va.asBool();
-		  }
-		sts << "]\"";
+		w.begin_array();
+		for (size_t j=0;j<strs.size();j++)
+		  w.value_int(ifs.str_count(j));
+		w.end_array();
 	      }
+	    else if (jsfc == scalar)
+	      w.value_int(ifs.str_count_size() > 0 ? ifs.str_count(0) : 1);
+	    else w.value_null();
 	  }
+	else if (aggregation == "sum" || aggregation == "count")
+	  {
+	    w.key(f.name());
+	    write_jsf();
+	    if (jsfh)
+	      {
+		w.key(f.name() + "_hold");
+		write_jsfh();
+	      }
+	  }
+	else if (aggregation == "ratio")
+	  {
+	    w.key(f.name());
+	    w.value_double(compute_ratio(f.numerator(), f.denominator()));
+	  }
+	else if (aggregation == "mean")
+	  {
+	    w.key(f.name());
+	    if (!jsfh)
+	      write_jsf();
+	    else if (jsf == scalar && (ftype == "int" || ftype == "float"))
+	      w.value_double(reap(0) / holder());
+	    else return false;
+	  }
+	else if (aggregation == "variance")
+	  {
+	    w.key(f.name());
+	    if (!jsfh)
+	      write_jsf();
+	    else if (jsf == array && (ftype == "int" || ftype == "float"))
+	      {
+		double n = holder();
+		w.value_double((reap(1) - (reap(0) * reap(0)) / n) / std::max(1.0,(n - 1)));
+	      }
+	    else return false;
+	  }
+      }
+    if (f.count() > 1)
+      {
+	w.key(f.name() + "_count");
+	w.value_uint(f.count());
+      }
+    return true;
+  }
+
+  double log_record::order_value(const int &i) const
+  {
+    const field &f = _ld.fields(i);
+    double v = 0.0, s2 = 0.0, n = 0.0;
+    if (f.type() == "int")
+      {
+	const int_field &ifi = f.int_fi();
+	if (ifi.int_reap_size() > 0)
+	  v = ifi.int_reap(0);
+	if (ifi.int_reap_size() > 1)
+	  s2 = ifi.int_reap(1);
+	n = ifi.holder();
+      }
+    else if (f.type() == "float")
+      {
+	const float_field &iff = f.real_fi();
+	if (iff.float_reap_size() > 0)
+	  v = iff.float_reap(0);
+	if (iff.float_reap_size() > 1)
+	  s2 = iff.float_reap(1);
+	n = iff.holder();
+      }
+    if (n != 0.0)
+      {
+	if (f.aggregation() == "mean")
+	  return v / n;
+	else if (f.aggregation() == "variance")
+	  return (s2 - (v * v) / n) / std::max(1.0,n - 1);
       }
-    if (header)
-      csvline = stshead.str() + "\n";
-    csvline += sts.str() + "\n";
-    //std::cerr << "csvline=" << csvline << std::endl;
+    return v;
   }
 
   float log_record::compute_ratio(const std::string &numerator,
@@ -37,6 +37,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include "record_writer.h"
 #include <jsoncpp/json/json.h>
 
 namespace miw
@@ -54,15 +55,27 @@ namespace miw
     void merge(log_record *lr); //TODO: need log format to check on aggregated fields etc ?
 
     void flatten_lines();
+
+    // moves the strings of the aggregated unions from their cache into
+    // the fields, as to_json outputs them.
+    void flatten_unions();
+
+    // binary form of the record, for spilling it to disk. unserialize
+    // returns nullptr on a malformed buffer.
+    void serialize(std::string &out);
+    static log_record* unserialize(const char *buf, const size_t &len);
     
     /*static void to_json_solr(field &f, Json::Value &jrec,
       std::string &date, std::string &time);*/
     void to_json(field &f, const int &i, Json::Value &jrec,
 		 std::string &date, std::string &time);
     void to_json(Json::Value &jlrec);
-    static void json_to_csv(const Json::Value &jl,
-			    std::string &csvline,
-			    const bool &header=false);
+
+    // pushes the record to a streaming writer, with the keys and values of
+    // to_json. false if a field needs to go through to_json instead.
+    bool write(record_writer &w);
+    bool write(record_writer &w, const field &f, const int &i,
+	       std::string &date, std::string &time);
 
     // compression for storage.
     static std::string compress_log_lines(const std::string &line);
@@ -92,6 +105,9 @@ namespace miw
     float compute_ratio(const std::string &numerator,
 				    const std::string &denominator);
 
+    // value of the aggregated numerical field i, as output, for ordering records.
+    double order_value(const int &i) const;
+
     std::string _key;
     long int _sum;
     logdef _ld;
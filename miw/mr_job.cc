@@ -28,18 +28,31 @@
 
 #include "mr_job.h"
 #include "defsplitter.hh"
+#include <unordered_set>
+#include <malloc.h>
+#include <errno.h>
+#include <unistd.h>
 
 //#define DEBUG
 
+__thread const char *mr_job::_counted_line = nullptr;
+
 void mr_job::map_function(split_t *ma)
 {
+  if (_counter)
+    {
+      map_counts(ma);
+      return;
+    }
   std::vector<log_record*> log_records;
-  std::string dat = (char*)ma->data; // XXX: copies the data
+  std::string dat((char*)ma->data,ma->length);
   _lf->parse_data(dat,ma->length,_app_name,_store_content,_compressed,_quiet,ma->pos,_skip_header,log_records);
   
 #ifdef DEBUG
   std::cout << "number of mapped records: " << log_records.size() << std::endl;
 #endif
+  if (sampling())
+    _sampled_records += log_records.size();
   for (size_t i=0;i<log_records.size();i++)
     {
       log_records.at(i)->_sum = 1;
@@ -49,6 +62,75 @@ void mr_job::map_function(split_t *ma)
     }
 }
 
+void mr_job::map_counts(split_t *ma)
+{
+  // same line selection as log_format::parse_data, emitting counts.
+  // The line goes along with the key, kept by key_copy for the output.
+  const char *d = (const char*)ma->data;
+  const char *end = d + ma->length;
+  const std::string &commentchar = _lf->_ldef.commentchar();
+  bool first = true;
+  std::string line,key;
+  while (d < end)
+    {
+      const char *eol = (const char*)memchr(d,'\n',end-d);
+      if (!eol)
+	eol = end;
+      line.assign(d,eol-d);
+      d = eol + 1;
+      if (line.empty())
+	continue;
+      if (first && ma->pos == 0 && _skip_header)
+	{
+	  first = false;
+	  continue;
+	}
+      first = false;
+      if (line.substr(0,1) == commentchar)
+	continue;
+      if (!_lf->parse_key(line,_app_name,key))
+	continue;
+      _counted_line = line.c_str();
+      map_emit((void*)key.c_str(),(void*)1,key.length());
+      _counted_line = nullptr;
+      if (sampling())
+	++_sampled_records;
+    }
+}
+
+void mr_job::counts_to_records(xarray<keyval_t> *wc_vals)
+{
+  for (uint32_t i = 0; i < wc_vals->size(); i++)
+    {
+      keyval_t *kv = wc_vals->at(i);
+      const char *k = (const char*)kv->key_;
+      std::string line(k + strlen(k) + 1);
+      int skipped_logs = 0;
+      log_record *lr = _lf->parse_line(line,_app_name,false,false,_quiet,skipped_logs);
+      if (!lr)
+	lr = new log_record(k,_lf->_ldef);
+      lr->_sum = (intptr_t)kv->val;
+      kv->val = lr;
+    }
+}
+
+void mr_job::sample_done(size_t predicted_nkey, size_t nreduce_task,
+			 size_t sampled_bytes, size_t sampled_heap)
+{
+  const size_t records = _sampled_records.exchange(0);
+  if (!sampled_bytes)
+    return;
+  // the input itself is mapped next to the records built from it
+  _sampled_factor = 1.0 + double(sampled_heap) / sampled_bytes;
+  _sampled_nkey = predicted_nkey;
+  const double record_size = records ? double(sampled_heap) / records : 0.0;
+  LOG(INFO) << "sampled " << sampled_bytes << " bytes into " << records << " records of "
+	    << record_size << " bytes: memory factor " << _sampled_factor
+	    << ", " << predicted_nkey << " keys predicted (about "
+	    << (size_t)(predicted_nkey * record_size) << " bytes of merged records), "
+	    << nreduce_task << " reduce tasks";
+}
+
 int mr_job::combine_function(void *key_in, void **vals_in, size_t vals_len)
 {
   log_record **lrecords = (log_record**)vals_in;
@@ -71,39 +153,125 @@ void mr_job::reduce_function(void *key_in, void **vals_in, size_t vals_len)
     reduce_emit(key_in,(void*)lrecords[0]);
 }
 
+void mr_job::set_order(const std::string &order, const size_t &limit)
+{
+  _order_field = -1;
+  _order_limit = limit;
+  if (order == "none")
+    _order = order_none;
+  else if (order == "key")
+    _order = order_key;
+  else
+    {
+      _order = order_value_desc;
+      if (order != "count")
+	{
+	  for (int i=0;i<_lf->_ldef.fields_size();i++)
+	    {
+	      const field &f = _lf->_ldef.fields(i);
+	      if (f.name() == order && f.aggregated()
+		  && (f.type() == "int" || f.type() == "float")
+		  && (f.aggregation() == "sum" || f.aggregation() == "count" || f.aggregation() == "max"
+		      || f.aggregation() == "mean" || f.aggregation() == "variance"))
+		_order_field = i;
+	    }
+	  if (_order_field < 0)
+	    LOG(ERROR) << "cannot order by " << order << ", not an aggregated numerical field, ordering by count";
+	}
+    }
+  if (_order == order_none)
+    set_output_order(output_unordered);
+  else if (_order == order_key)
+    set_output_order(output_key_order,limit);
+  else set_output_order(output_compare_order,limit);
+}
+
+void mr_job::set_csv(const std::string &quoting, const std::string &separator)
+{
+  int q = csv_writer::quote_strings;
+  if (quoting == "minimal")
+    q = csv_writer::quote_minimal;
+  else if (quoting == "all")
+    q = csv_writer::quote_all;
+  else if (quoting != "strings")
+    LOG(ERROR) << "unknown CSV quoting " << quoting << ", quoting strings";
+  char sep = ',';
+  if (separator == "tab" || separator == "\\t")
+    sep = '\t';
+  else if (separator.length() == 1)
+    sep = separator[0];
+  else LOG(ERROR) << "CSV separator must be a single character, using ','";
+  std::vector<std::string> columns;
+  if (!_lf->output_columns(_app_name,columns))
+    columns.clear();
+  _csv = csv_writer(sep,q,columns);
+}
+
+namespace
+{
+  // heap order: the root is the entry that leaves the top first.
+  struct top_greater
+  {
+    bool operator()(const std::pair<double,std::string> &e1,
+		    const std::pair<double,std::string> &e2) const
+    {
+      if (e1.first != e2.first)
+	return e1.first > e2.first;
+      return e1.second < e2.second;
+    }
+  };
+}
+
+void mr_job::add_top(std::vector<std::pair<double,std::string>> &top, const int &ndisp,
+		     const double &v, const char *key)
+{
+  top_greater cmp;
+  if ((int)top.size() < ndisp)
+    {
+      top.push_back(std::pair<double,std::string>(v,key));
+      std::push_heap(top.begin(),top.end(),cmp);
+    }
+  else if (ndisp > 0 && (v > top.front().first
+			 || (v == top.front().first && key < top.front().second)))
+    {
+      std::pop_heap(top.begin(),top.end(),cmp);
+      top.back().first = v;
+      top.back().second = key;
+      std::push_heap(top.begin(),top.end(),cmp);
+    }
+}
+
 void mr_job::print_top(xarray<keyval_t> *wc_vals, int &ndisp) {
   size_t occurs = 0;
-    std::multimap<long,std::string,std::greater<long> > ordered_records;
-    std::multimap<long,std::string,std::greater<long> >::iterator mit;
-    for (uint32_t i = 0; i < wc_vals->size(); i++)
-      {
-	log_record *lr = (log_record*)wc_vals->at(i)->val;
-	occurs += lr->_sum;
-	ordered_records.insert(std::pair<long,std::string>(lr->_sum,lr->key()));
-	if ((int)ordered_records.size() > ndisp)
-	  {
-	    mit = ordered_records.end();
-	    mit--;
-	    ordered_records.erase(mit);
-	  }
-      }
-    printf("\nlogs preprocessing: results (TOP %d from %zu keys, %zd logs):\n",
-           ndisp, wc_vals->size(), occurs);
+  // fixed-size heap of the ndisp records of highest value
+  std::vector<std::pair<double,std::string>> top;
+  for (uint32_t i = 0; i < wc_vals->size(); i++)
+    {
+      keyval_t *kv = wc_vals->at(i);
+      occurs += ((log_record*)kv->val)->_sum;
+      add_top(top,ndisp,record_value((log_record*)kv->val),(char*)kv->key_);
+    }
+  print_top(top,wc_vals->size(),occurs,ndisp);
+}
+
+void mr_job::print_top(std::vector<std::pair<double,std::string>> &top,
+		       const size_t &nkeys, const size_t &occurs, int &ndisp)
+{
+  std::sort_heap(top.begin(),top.end(),top_greater());
+  printf("\nlogs preprocessing: results (TOP %d from %zu keys, %zd logs):\n",
+	 ndisp, nkeys, occurs);
 #ifdef HADOOP
-    ndisp = wc_vals->size();
+  ndisp = nkeys;
 #else
-    ndisp = std::min(ndisp, (int)wc_vals->size());
+  ndisp = std::min(ndisp, (int)nkeys);
 #endif
-    int c = 0;
-    mit = ordered_records.begin();
-    while(mit!=ordered_records.end())
-      {
-	printf("%45s - %ld\n",(*mit).second.c_str(),(*mit).first);
-	++mit;
-	if (c++ == ndisp)
-	  break;
-      }
-    std::cout << std::endl;
+  for (size_t i = 0; i < top.size(); i++)
+    {
+      if (_order_field >= 0)
+	printf("%45s - %g\n",top[i].second.c_str(),top[i].first);
+      else printf("%45s - %ld\n",top[i].second.c_str(),(long)top[i].first);
+    }
+  std::cout << std::endl;
 }
 
 void mr_job::output_all(xarray<keyval_t> *wc_vals, std::ostream &fout) 
@@ -115,49 +283,409 @@ void mr_job::output_all(xarray<keyval_t> *wc_vals, std::ostream &fout)
     }
 }
 
+template<class W, class F>
+void mr_job::output_ordered(xarray<keyval_t> *wc_vals, std::ostream &fout,
+			    const W &writer, const F &serialize)
+{
+  // contiguous ranges of records are serialized concurrently, and each
+  // buffer is written as soon as the ones before it are, while the next
+  // ranges are serialized.
+  const long n = wc_vals->size();
+  const long nchunks = (n + output_chunk - 1) / output_chunk;
+  const int nthreads = std::max(1L,std::min(nchunks,(long)(_nthreads > 0 ? _nthreads : omp_get_max_threads())));
+#pragma omp parallel for ordered schedule(dynamic,1) num_threads(nthreads)
+  for (long c = 0; c < nchunks; c++)
+    {
+      W w(writer);
+      std::string buf;
+      for (long i = c * output_chunk; i < std::min(n,(c+1) * output_chunk); i++)
+	serialize(i,(log_record*)wc_vals->at(i)->val,w,buf);
+#pragma omp ordered
+      fout << buf;
+    }
+}
+
 void mr_job::output_json(xarray<keyval_t> *wc_vals, std::ostream &fout)
 {
-  Json::FastWriter writer;
-  for (uint32_t i = 0; i < wc_vals->size(); i++) 
+  output_ordered(wc_vals,fout,json_writer(),[this](const long &i, log_record *lr, json_writer &jw, std::string &out)
+		 {
+		   record_json(lr,jw,out);
+		 });
+}
+
+void mr_job::record_json(log_record *lr, json_writer &jw, std::string &out)
+{
+  if (!_compressed)
+    lr->flatten_lines();
+  else
     {
-      log_record *lr = (log_record*)wc_vals->at(i)->val;
+      lr->_uncompressed_lines = log_record::uncompress_log_lines(lr->_compressed_lines);
+      lr->_compressed_lines.clear();
+      lr->_original_size = lr->_uncompressed_lines.length();
+    }
+  jw.begin();
+  if (lr->write(jw))
+    jw.end(out);
+  else
+    {
+      Json::FastWriter writer;
       Json::Value jrec;
       lr->to_json(jrec);
-      if (!_compressed)
-	lr->flatten_lines();
-      else
+      out += writer.write(jrec);
+    }
+  if (!lr->_uncompressed_lines.empty())
+    {
+      // {"content":{"add":...},"id":...,"original_size":...}
+      const std::string id = lr->key() + "_content";
+      out += "{\"content\":{\"add\":";
+      json_writer::append_quoted(out,lr->_uncompressed_lines.data(),lr->_uncompressed_lines.length());
+      out += "},\"id\":";
+      json_writer::append_quoted(out,id.data(),id.length());
+      out += ",\"original_size\":";
+      record_writer::append_int(out,lr->_original_size);
+      out += "}\n";
+    }
+}
+
+void mr_job::write_record(log_record *lr, record_writer &w)
+{
+  w.begin();
+  if (lr->write(w))
+    return;
+  w.begin();
+  Json::Value jrec;
+  lr->to_json(jrec);
+  w.write(jrec);
+}
+
+void mr_job::output_csv(xarray<keyval_t> *wc_vals, const int &nfile, std::ostream &fout)
+{
+  if (wc_vals->size() == 0)
+    return;
+  csv_writer cw(_csv);
+  if (!cw.has_columns())
+    {
+      // the format generates fields, the first record gives the columns
+      write_record((log_record*)wc_vals->at(0)->val,cw);
+      cw.record_columns();
+    }
+  if (nfile <= 0)
+    {
+      std::string header;
+      cw.header(header);
+      fout << header;
+    }
+  output_ordered(wc_vals,fout,cw,[this](const long &i, log_record *lr, csv_writer &w, std::string &out)
+		 {
+		   write_record(lr,w);
+		   //TODO: add attached logs UUIDs to every entry
+		   w.end(out);
+		 });
+}
+
+bool mr_job::reduce_output(int task, xarray<keyval_t> *out)
+{
+  if (!_sharded)
+    return false;
+  if (_counter)
+    counts_to_records(out);
+  json_writer jw;
+  csv_writer cw(_csv);
+  // buckets are small, a worker fills its row group over several of them
+  columnar_group *cg = _sharded_format == "columnar" ? worker_group() : nullptr;
+  std::string buf,header;
+  std::vector<std::pair<double,std::string>> top;
+  size_t occurs = 0;
+  for (uint32_t i = 0; i < out->size(); i++)
+    {
+      keyval_t *kv = out->at(i);
+      log_record *lr = (log_record*)kv->val;
+      occurs += lr->_sum;
+      add_top(top,_sharded_ndisp,record_value(lr),(char*)kv->key_);
+      if (_sharded_format == "json")
 	{
-	  lr->_uncompressed_lines = log_record::uncompress_log_lines(lr->_compressed_lines);
-	  lr->_compressed_lines.clear();
-	  lr->_original_size = lr->_uncompressed_lines.length();
+	  record_json(lr,jw,buf);
+	  continue;
 	}
-      fout << writer.write(jrec);
-      if (!lr->_uncompressed_lines.empty())
+      if (cg)
 	{
-	  Json::Value jrecc;
-	  jrecc["id"] = lr->key() + "_content";
-	  jrecc["original_size"] = lr->_original_size;
-	  jrecc["content"]["add"] = lr->_uncompressed_lines;
-	  //fout << "{\"compressed_size\":" << lr->_compressed_size << ",\"content\":{\"add\":\"" << lr->_compressed_lines << "\"},\"id\":" << lr->key()+"_content" << ",\"original_size\":" << lr->_original_size << "}\n";
-	  fout << writer.write(jrecc);
+	  write_record(lr,*cg);
+	  cg->end(buf);
+	  continue;
 	}
+      write_record(lr,cw);
+      if (i == 0)
+	{
+	  // each shard starts with its header line. Without columns in the
+	  // format, the first record of the run gives them to every task
+	  if (!cw.has_columns())
+	    {
+	      std::lock_guard<std::mutex> lock(_top_mutex);
+	      if (_sharded_columns.empty())
+		{
+		  cw.record_columns();
+		  _sharded_columns = cw.columns();
+		}
+	      else cw.set_columns(_sharded_columns);
+	    }
+	  cw.header(header);
+	}
+      cw.end(buf);
     }
+  if (!cg)
+    _shards->write(task,buf,header);
+  else if (cg->rows() >= columnar_rows)
+    flush_group(cg);
+  free_records(out);
+
+  std::lock_guard<std::mutex> lock(_top_mutex);
+  _sharded_keys += out->size();
+  _sharded_logs += occurs;
+  for (size_t i = 0; i < top.size(); i++)
+    add_top(_top,_sharded_ndisp,top[i].first,top[i].second.c_str());
+  return true;
 }
 
-void mr_job::output_csv(xarray<keyval_t> *wc_vals, const int &nfile, std::ostream &fout)
+columnar_group* mr_job::worker_group()
 {
-  for (uint32_t i = 0; i < wc_vals->size(); i++) 
+  std::lock_guard<std::mutex> lock(_columnar_mutex);
+  columnar_group *&cg = _columnar_groups[std::this_thread::get_id()];
+  if (!cg)
+    cg = new columnar_group();
+  return cg;
+}
+
+void mr_job::flush_group(columnar_group *cg)
+{
+  _columnar->write(_columnar_key + _columnar_seq++,*cg);
+  cg->clear();
+}
+
+void mr_job::flush_groups()
+{
+  std::lock_guard<std::mutex> lock(_columnar_mutex);
+  for (auto git = _columnar_groups.begin();git!=_columnar_groups.end();++git)
     {
-      log_record *lr = (log_record*)wc_vals->at(i)->val;
-      Json::Value jrec;
-      lr->to_json(jrec);
-      std::string csvline;
-      if (i == 0 && nfile <= 0)
-	log_record::json_to_csv(jrec,csvline,true); // with header
-      else log_record::json_to_csv(jrec,csvline);
-      //TODO: add attached logs UUIDs to every entry
-      fout << csvline;
+      _columnar->write(_columnar_key + _columnar_seq++,*(*git).second);
+      delete (*git).second;
+    }
+  _columnar_groups.clear();
+}
+
+void mr_job::output_columnar(xarray<keyval_t> *wc_vals)
+{
+  // a row group per range of records, encoded concurrently
+  const long n = wc_vals->size();
+  const long ngroups = (n + columnar_rows - 1) / columnar_rows;
+  const uint64_t key = _columnar->next_output();
+  const int nthreads = std::max(1L,std::min(ngroups,(long)(_nthreads > 0 ? _nthreads : omp_get_max_threads())));
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthreads)
+  for (long g = 0; g < ngroups; g++)
+    {
+      columnar_group cg;
+      std::string unused;
+      for (long i = g * columnar_rows; i < std::min(n,(g+1) * columnar_rows); i++)
+	{
+	  write_record((log_record*)wc_vals->at(i)->val,cg);
+	  cg.end(unused);
+	}
+      _columnar->write(key + g,cg);
+    }
+}
+
+void mr_job::spill_state(xarray<keyval_t> *wc_vals)
+{
+  if (!wc_vals->size())
+    return;
+  std::vector<log_record*> records;
+  records.reserve(wc_vals->size());
+  for (uint32_t i = 0; i < wc_vals->size(); i++)
+    records.push_back((log_record*)wc_vals->at(i)->val);
+  if (_spill.spill(records) < 0)
+    {
+      LOG(ERROR) << "unable to spill " << records.size() << " records, keeping them in memory";
+      return;
     }
+  LOG(INFO) << "spilled " << records.size() << " records to run #" << _spill.size();
+  free_records(wc_vals);
+  for (uint32_t i = 0; i < wc_vals->size(); i++)
+    {
+      key_free(wc_vals->at(i)->key_);
+      wc_vals->at(i)->reset();
+    }
+  wc_vals->trim(0);
+  malloc_trim(0); // gives the freed state back to the system
+}
+
+void mr_job::held_records(xarray<keyval_t> *wc_vals, std::vector<log_record*> &held)
+{
+  for (uint32_t i = 0; i < wc_vals->size(); i++)
+    held.push_back((log_record*)wc_vals->at(i)->val);
+  std::sort(held.begin(),held.end(),[](log_record *lr1, log_record *lr2)
+	    {
+	      return spill_runs::key_less(lr1->_key,lr2->_key);
+	    });
+  if (!held.empty())
+    LOG(WARNING) << "merging " << held.size() << " records kept in memory with the spilled runs";
+}
+
+int mr_job::write_partial(const std::string &fname)
+{
+  spill_state(&results_);
+  std::vector<log_record*> held;
+  held_records(&results_,held);
+  free_results();
+  std::string tmp = fname + ".tmp";
+  FILE *f = fopen(tmp.c_str(),"w");
+  if (!f)
+    {
+      LOG(ERROR) << "unable to open partial results file " << tmp << ": " << strerror(errno);
+      for (size_t i = 0; i < held.size(); i++)
+	delete held.at(i);
+      _spill.close();
+      return -1;
+    }
+  setvbuf(f,nullptr,_IOFBF,1<<20);
+  std::string buf;
+  bool written = true;
+  size_t n = 0;
+  int err = _spill.merge([&](log_record *lr)
+			 {
+			   written = spill_runs::write_record(f,lr,buf);
+			   delete lr;
+			   ++n;
+			   return written;
+			 },held);
+  for (size_t i = 0; i < held.size(); i++)
+    delete held.at(i);
+  _spill.close();
+  if (err < 0 || !written || fflush(f) != 0 || fsync(fileno(f)) != 0)
+    {
+      LOG(ERROR) << "unable to write partial results file " << tmp << ": " << strerror(errno);
+      fclose(f);
+      unlink(tmp.c_str());
+      return -1;
+    }
+  fclose(f);
+  if (rename(tmp.c_str(),fname.c_str()) != 0)
+    {
+      LOG(ERROR) << "unable to rename partial results file " << tmp << ": " << strerror(errno);
+      unlink(tmp.c_str());
+      return -1;
+    }
+  LOG(INFO) << "wrote " << n << " merged records to " << fname;
+  return 0;
+}
+
+void mr_job::output_batch(xarray<keyval_t> *batch, const std::string &output_format,
+			  const int &nfile, std::ofstream &fout, xarray<keyval_t> *results)
+{
+  if (output_format == "mem" && results)
+    {
+      for (uint32_t i = 0; i < batch->size(); i++)
+	results->push_back(*batch->at(i));
+      batch->trim(0);
+      return;
+    }
+  if (fout.is_open())
+    {
+      if (output_format == "json")
+	output_json(batch,fout);
+      else if (output_format == "csv")
+	output_csv(batch,nfile,fout);
+      else if (output_format.empty())
+	output_all(batch,fout);
+    }
+  else if (output_format == "columnar" && _columnar)
+    output_columnar(batch);
+  else if (output_format == "json")
+    output_json(batch,std::cout);
+  free_records(batch);
+  for (uint32_t i = 0; i < batch->size(); i++)
+    {
+      key_free(batch->at(i)->key_);
+      batch->at(i)->reset();
+    }
+  batch->trim(0);
+}
+
+void mr_job::output_spilled(const std::string &output_format, const int &nfile,
+			    int &ndisp, std::ofstream &fout, xarray<keyval_t> *results)
+{
+  // the final state is spilled as the last run, and the runs are merged
+  // into the output in key order, a batch of records at a time
+  spill_state(&results_);
+  std::vector<log_record*> held;
+  held_records(&results_,held);
+  free_results();
+  LOG(INFO) << "merging " << _spill.size() << " runs of " << _spill.records() << " spilled records";
+
+  // records ordered by value lead the output, the others follow in key order
+  std::vector<log_record*> lead;
+  std::unordered_set<std::string> lead_keys;
+  if (_order == order_value_desc && _order_limit == 0)
+    LOG(WARNING) << "spilled records are output in key order, -order_limit orders the leading ones by value";
+  else if (_order == order_value_desc)
+    {
+      // heap of the leading records, its root being the last of them
+      auto before = [this](log_record *lr1, log_record *lr2)
+	{
+	  double v1 = record_value(lr1), v2 = record_value(lr2);
+	  if (v1 != v2)
+	    return v1 > v2;
+	  return lr1->_key < lr2->_key;
+	};
+      _spill.merge([&](log_record *lr)
+		   {
+		     lead.push_back(lr);
+		     std::push_heap(lead.begin(),lead.end(),before);
+		     if (lead.size() > _order_limit)
+		       {
+			 std::pop_heap(lead.begin(),lead.end(),before);
+			 delete lead.back();
+			 lead.pop_back();
+		       }
+		     return true;
+		   },held);
+      std::sort_heap(lead.begin(),lead.end(),before);
+      for (size_t i = 0; i < lead.size(); i++)
+	lead_keys.insert(lead.at(i)->_key);
+    }
+
+  xarray<keyval_t> batch;
+  std::vector<std::pair<double,std::string>> top;
+  size_t nkeys = 0, occurs = 0;
+  int bfile = nfile; // the CSV header goes with the first batch
+  auto add = [&](log_record *lr)
+    {
+      keyval_t kv;
+      kv.key_ = key_copy((void*)lr->_key.c_str(),lr->_key.length());
+      kv.val = lr;
+      batch.push_back(kv);
+      ++nkeys;
+      occurs += lr->_sum;
+      add_top(top,ndisp,record_value(lr),lr->_key.c_str());
+      if (batch.size() >= columnar_rows)
+	{
+	  output_batch(&batch,output_format,bfile,fout,results);
+	  bfile = 1;
+	}
+    };
+  for (size_t i = 0; i < lead.size(); i++)
+    add(lead.at(i));
+  _spill.merge([&](log_record *lr)
+	       {
+		 if (!lead_keys.empty() && lead_keys.count(lr->_key))
+		   delete lr;
+		 else add(lr);
+		 return true;
+	       },held);
+  output_batch(&batch,output_format,bfile,fout,results);
+  batch.shallow_free();
+  for (size_t i = 0; i < held.size(); i++)
+    delete held.at(i);
+  _spill.close();
+  print_top(top,nkeys,occurs,ndisp);
 }
 
 void mr_job::output_mem(xarray<keyval_t> *wc_vals, xarray<keyval_t> *results)
@@ -44,10 +44,18 @@
 #include <chrono>
 #include <ctime>
 #include "str_utils.h"
+#include "output_shards.h"
+#include "columnar.h"
+#include "spill.h"
+#include "output_stage.h"
+#include "checkpoint.h"
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <omp.h>
 #include <glog/logging.h>
 
-enum { with_value_modifier = 0 };
-
 using namespace miw;
 
 class mr_job : public map_reduce
@@ -71,8 +79,20 @@ class mr_job : public map_reduce
   {
     defs_ = new defsplitter(d,size,nsplit);
   }
+ mr_job(const std::vector<std::string> &files, int nsplit,
+	const std::string &app_name,
+	log_format *lf,
+	const bool &store_content, const bool &compressed, const bool &quiet, const bool &skip_header)
+   : _app_name(app_name),_lf(lf),_store_content(store_content),
+    _compressed(compressed),_quiet(quiet),_skip_header(skip_header)
+  {
+    defs_ = new defsplitter(files,nsplit);
+  }
   virtual ~mr_job()
     {
+      checkpoint_wait();
+      for (size_t i = 0; i < _resumed.size(); i++)
+	delete _resumed.at(i);
       if (defs_)
 	delete defs_;
     }
@@ -89,23 +109,56 @@ class mr_job : public map_reduce
   bool split(split_t *ma, int ncores) {
     return defs_->split(ma, ncores, "\n",0);
   }
+
+  bool resize_splits(size_t first, size_t nbyte) {
+    return defs_->resize(first, nbyte);
+  }
   
   int key_compare(const void *s1, const void *s2) {
     return strcasecmp((const char *) s1, (const char *) s2);
   }
+
+  // keys equal for key_compare hash alike, so that they are merged
+  unsigned partition(void *k, int length) {
+    size_t h = 5381;
+    const char *x = (const char *) k;
+    for (int i = 0; i < length; ++i)
+      {
+	unsigned char c = x[i];
+	h = ((h << 5) + h) + unsigned(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+      }
+    return h % unsigned(-1);
+  }
   
   void run_no_final(const int &nprocs, const int &reduce_tasks,
 		    const int &quiet, const std::string output_format, const int &nfile,
-		    int &ndisp, std::ofstream &fout, const std::string &ofname, const bool &tmp_save, const bool &newfile)
+		    int &ndisp, std::ofstream &fout)
   {
     set_ncore(nprocs);
     set_reduce_task(reduce_tasks);
+    if (!_stage)
+      _nthreads = nprocs;
     sched_run_no_final();
     //std::cerr << "results size=" << get_reduce_bucket_manager()->rb0_size() << std::endl;
     xarray<keyval_t> *tmp_results = static_cast<reduce_bucket_manager<keyval_t>*>(get_reduce_bucket_manager())->get(0);
-    print_top(tmp_results, ndisp);
-    if (tmp_save && newfile)
-      temp_state_save(output_format,tmp_results,ofname); // ability to store temporary state, e.g. in CSV form
+    if (_stage)
+      {
+	// the results are read by the output stage until the next run has
+	// mapped its input, see map_done
+	int disp = ndisp;
+	_stage->push([this,tmp_results,disp]()
+		     {
+		       int nd = disp;
+		       print_top(tmp_results, nd);
+		     });
+      }
+    else print_top(tmp_results, ndisp);
+    if (_max_memory > 0 && tmp_results->size()
+	&& spill_runs::resident_memory() > _max_memory / 2)
+      {
+	output_wait();
+	spill_state(tmp_results);
+      }
   }
   
   void run(const int &nprocs, const int &reduce_tasks,
@@ -114,8 +167,57 @@ class mr_job : public map_reduce
   {
     set_ncore(nprocs);
     set_reduce_task(reduce_tasks);
+    if (!_stage)
+      _nthreads = nprocs;
+    // reduce tasks write their output to the shards as they complete
+    _sharded = _order == order_none
+      && ((_shards && (output_format == "json" || output_format == "csv"))
+	  || (_columnar && output_format == "columnar"));
+    if (_sharded)
+      {
+	if (_columnar)
+	  {
+	    _columnar_key = _columnar->next_output();
+	    _columnar_seq = 0;
+	  }
+	_sharded_format = output_format;
+	_sharded_ndisp = ndisp;
+	_sharded_keys = _sharded_logs = 0;
+	_sharded_columns.clear();
+	_top.clear();
+      }
     sched_run();
-    print_top(&results_, ndisp);
+    if (_stage && !_sharded)
+      {
+	// the results are written by the output stage while the next
+	// input is mapped
+	print_stats();
+	xarray<keyval_t> *wc_vals = new xarray<keyval_t>();
+	results_.transfer(wc_vals);
+	int disp = ndisp;
+	std::ofstream *out = &fout;
+	_stage->push([this,wc_vals,disp,output_format,nfile,out,results]()
+		    {
+		      int nd = disp;
+		      if (_counter)
+			counts_to_records(wc_vals);
+		      print_top(wc_vals, nd);
+		      output_results(wc_vals, output_format, nfile, *out, results);
+		      release_results(wc_vals);
+		      delete wc_vals;
+		    });
+	return;
+      }
+    if (_counter)
+      counts_to_records(&results_);
+    if (_sharded)
+      {
+	if (_columnar)
+	  flush_groups();
+	print_top(_top,_sharded_keys,_sharded_logs,ndisp);
+	_sharded = false;
+      }
+    else print_top(&results_, ndisp);
     run_finalize(quiet, output_format, nfile, ndisp, fout, results);
   }
 
@@ -127,68 +229,201 @@ class mr_job : public map_reduce
     //if (!quiet)
     //print_top(&results_, ndisp);
     print_stats();
+    if (_spill.size())
+      {
+	output_spilled(output_format,nfile,ndisp,fout,results);
+	return;
+      }
+    output_results(&results_,output_format,nfile,fout,results);
+    free_records(&results_);
+    free_results();
+  }
+
+  void output_results(xarray<keyval_t> *wc_vals, const std::string &output_format,
+		      const int &nfile, std::ofstream &fout,
+		      xarray<keyval_t> *results=nullptr)
+  {
     if (fout.is_open()) 
       {
 	if (output_format == "json")
-	  output_json(&results_,fout);
+	  output_json(wc_vals,fout);
 	else if (output_format == "csv")
-	  output_csv(&results_,nfile,fout);
+	  output_csv(wc_vals,nfile,fout);
 	else if (output_format.empty())
-	  output_all(&results_,fout);
+	  output_all(wc_vals,fout);
       }
+    else if (output_format == "columnar" && _columnar)
+      output_columnar(wc_vals);
     else if (output_format == "json")
-      output_json(&results_,std::cout);
+      output_json(wc_vals,std::cout);
     else if (output_format == "mem")
-      output_mem(&results_,results);
-    free_records(&results_);
-    free_results();
+      output_mem(wc_vals,results);
   }
 
-  void temp_state_save(const std::string &output_format,
-		       xarray<keyval_t> *results,
-		       const std::string &ofname)
+  // frees the records and keys of results taken out of results_.
+  void release_results(xarray<keyval_t> *wc_vals)
   {
-    std::chrono::time_point<std::chrono::system_clock> now_tp = std::chrono::system_clock::now();
-    std::time_t now_time = std::chrono::system_clock::to_time_t(now_tp);
-    std::string now_date = std::ctime(&now_time);
-    std::replace(now_date.begin(),now_date.end(),' ','_');
-    std::replace(now_date.begin(),now_date.end(),'?','_');
-    std::replace(now_date.begin(),now_date.end(),'\n','_');
+    free_records(wc_vals);
+    for (size_t i = 0; i < wc_vals->size(); ++i)
+      {
+	key_free(wc_vals->at(i)->key_);
+	wc_vals->at(i)->reset();
+      }
+    wc_vals->shallow_free();
+  }
 
-    std::ofstream fout;
-    std::vector<std::string> tmp_ofnamev;
-    str_utils::str_split(ofname,'.',tmp_ofnamev);
-    std::string tmp_ofname = tmp_ofnamev[0] + '_' + now_date + '.' + tmp_ofnamev[1];
-    fout.open(tmp_ofname);
-    if (!fout.is_open())
+  void output_wait()
+  {
+    if (_stage)
+      _stage->wait();
+  }
+
+  // the output stage is done with the results of the previous run before
+  // they are merged into the next one.
+  void map_done()
+  {
+    output_wait();
+    for (size_t i = 0; i < _resumed.size(); i++)
       {
-	LOG(ERROR) << "unable to open temporary output file=" << tmp_ofname;
-	return;
+	log_record *lr = _resumed.at(i);
+	map_emit((void*)lr->_key.c_str(),(void*)lr,lr->_key.length());
       }
-    else
+    _resumed.clear();
+  }
+
+  // snapshot of the merged results and of their spilled runs from
+  // first_run on, written by a forked child while the next runs go on.
+  // One snapshot is written at a time.
+  void checkpoint_save(const checkpoint &pos, const std::string &fname,
+		       const size_t &first_run=0)
+  {
+    checkpoint_wait();
+    xarray<keyval_t> *tmp_results = static_cast<reduce_bucket_manager<keyval_t>*>(get_reduce_bucket_manager())->get(0);
+    _checkpoint_fname = fname;
+    _checkpoint_pid = pos.save(fname,[this,tmp_results,first_run](FILE *f)
+			       {
+				 std::string buf;
+				 for (uint32_t i = 0; i < tmp_results->size(); i++)
+				   if (!spill_runs::write_record(f,(log_record*)tmp_results->at(i)->val,buf))
+				     return false;
+				 return _spill.copy_runs(f,first_run) == 0;
+			       });
+  }
+
+  void checkpoint_wait()
+  {
+    if (_checkpoint_pid > 0)
+      checkpoint::wait(_checkpoint_pid,_checkpoint_fname);
+    _checkpoint_pid = -1;
+  }
+
+  // spills the results so far and the records to resume, so that the
+  // next runs start from no results and can be saved apart. false if
+  // they could not be spilled.
+  bool hold_results()
+  {
+    if (!_resumed.empty())
       {
-	if (output_format == "csv")
-	  {
-	    output_csv(results,-1,fout);
-	    LOG(INFO) << "temporary result saved in " << tmp_ofname;
-	  }
+	if (_spill.spill(_resumed) < 0)
+	  return false;
+	for (size_t i = 0; i < _resumed.size(); i++)
+	  delete _resumed.at(i);
+	_resumed.clear();
+      }
+    if (get_reduce_bucket_manager()->get_init())
+      {
+	xarray<keyval_t> *tmp_results = static_cast<reduce_bucket_manager<keyval_t>*>(get_reduce_bucket_manager())->get(0);
+	spill_state(tmp_results);
+	if (tmp_results->size())
+	  return false;
+      }
+    _held_runs = _spill.size();
+    _held_compactions = _spill.compactions();
+    return true;
+  }
+
+  // snapshot of the results since hold_results.
+  void cache_save(const checkpoint &pos, const std::string &fname)
+  {
+    if (_spill.compactions() != _held_compactions)
+      {
+	LOG(WARNING) << "spilled runs were merged over several files, not caching the results of file=" << pos._fname;
+	return;
       }
-    fout.close();
+    checkpoint_save(pos,fname,_held_runs);
   }
 
+  // final results and their spilled runs merged into fname, sorted by
+  // key in the form of the runs, as the partial results of a worker. The
+  // final results that cannot be spilled are merged from memory, as they
+  // are by output_spilled. -1 on error.
+  int write_partial(const std::string &fname);
+
+  // partial results of a worker, as written by write_partial, merged
+  // into the output. The file is removed. -1 on error.
+  int add_partial(const std::string &fname)
+  {
+    return _spill.add(fname);
+  }
+
+  // records of a checkpoint or of cached files, merged into the results
+  // of the next run.
+  void resume(std::vector<log_record*> &records)
+  {
+    _resumed.insert(_resumed.end(),records.begin(),records.end());
+    records.clear();
+  }
+  
   // output functions
   void print_top(xarray<keyval_t> *wc_vals, int &ndisp);
+  void print_top(std::vector<std::pair<double,std::string>> &top,
+		 const size_t &nkeys, const size_t &occurs, int &ndisp);
+  static void add_top(std::vector<std::pair<double,std::string>> &top, const int &ndisp,
+		      const double &v, const char *key);
   void output_all(xarray<keyval_t> *wc_vals, std::ostream &fout);
   void output_json(xarray<keyval_t> *wc_vals, std::ostream &fout);
   void output_csv(xarray<keyval_t> *wc_vals, const int &nfile, std::ostream &fout);
   void output_mem(xarray<keyval_t> *wc_vals, xarray<keyval_t> *results);
+  void output_columnar(xarray<keyval_t> *wc_vals);
+  void output_spilled(const std::string &output_format, const int &nfile,
+		      int &ndisp, std::ofstream &fout, xarray<keyval_t> *results);
+  void output_batch(xarray<keyval_t> *batch, const std::string &output_format,
+		    const int &nfile, std::ofstream &fout, xarray<keyval_t> *results);
+  columnar_group* worker_group();
+  void flush_group(columnar_group *cg);
+  void flush_groups();
+  void record_json(log_record *lr, json_writer &jw, std::string &out);
+  void write_record(log_record *lr, record_writer &w);
+  template<class W, class F>
+  void output_ordered(xarray<keyval_t> *wc_vals, std::ostream &fout,
+		      const W &writer, const F &serialize);
+
+  // aggregated state spilled to disk under the memory budget
+  void spill_state(xarray<keyval_t> *wc_vals);
+
+  // records left in wc_vals by spill_state, sorted by key as the runs are,
+  // for merging them with the runs.
+  static void held_records(xarray<keyval_t> *wc_vals, std::vector<log_record*> &held);
+
+  // sharded output, by the reduce tasks
+  bool reduce_output(int task, xarray<keyval_t> *out);
   
+  // memory of the records per input byte, measured by sampling
+  void sample_done(size_t predicted_nkey, size_t nreduce_task,
+		   size_t sampled_bytes, size_t sampled_heap);
+
+  // counter engine
+  void map_counts(split_t *ma);
+  void counts_to_records(xarray<keyval_t> *wc_vals);
+
   // map reduce
   void map_function(split_t *ma);
   void reduce_function(void *key_in, void **vals_in, size_t vals_len);
   int combine_function(void *key_in, void **vals_in, size_t vals_len);
   
   void *modify_function(void *oldv, void *newv) {
+    if (_counter)
+      return (void*)((intptr_t)oldv + (intptr_t)newv);
     log_record *lr1 = (log_record*) oldv;
     log_record *lr2 = (log_record*) newv;
     //lr1->_sum += lr2->_sum;
@@ -198,9 +433,14 @@ class mr_job : public map_reduce
    }
   
   void *key_copy(void *src, size_t s) {
-    char *key = safe_malloc<char>(s + 1);
+    // counter keys are followed by the line they were first seen in, as
+    // emitted by map_counts, or by an empty one when copied elsewhere
+    const char *line = _counted_line ? _counted_line : "";
+    size_t n = _counter ? strlen(line) + 1 : 0;
+    char *key = safe_malloc<char>(s + 1 + n);
     memcpy(key, src, s);
     key[s] = 0;
+    memcpy(key + s + 1, line, n);
     return key;
   }
   
@@ -213,19 +453,77 @@ class mr_job : public map_reduce
 #ifdef HADOOP
     return strcmp((char *) kv1->key_, (char *) kv2->key_);
 #else
-    /*if (alphanumeric)
-      return strcmp((char *) kv1->key_, (char *) kv2->key_);*/
-    size_t i1 = (size_t) kv1->val;
-    size_t i2 = (size_t) kv2->val;
-    if (i1 != i2)
-      return i2 - i1;
+    if (_order == order_key)
+      return key_compare(kv1->key_, kv2->key_);
+    double v1 = order_value(kv1->val);
+    double v2 = order_value(kv2->val);
+    if (v1 != v2)
+      return v1 > v2 ? -1 : 1;
     else
       return strcmp((char *) kv1->key_, (char *) kv2->key_);
 #endif
   }
+
+  // value records are ordered by, decreasing: count of logs or aggregated field.
+  // Counter values are only turned into records after the merge.
+  double order_value(void *val) const
+  {
+    if (_counter)
+      return (intptr_t)val;
+    return record_value((log_record*)val);
+  }
+
+  double record_value(log_record *lr) const
+  {
+    if (_order_field >= 0)
+      return lr->order_value(_order_field);
+    return lr->_sum;
+  }
+
+  void set_order(const std::string &order, const size_t &limit);
   
   bool has_value_modifier() const {
-    return with_value_modifier;
+    return _value_modifier || _counter;
+  }
+
+  void set_value_modifier(const bool &vm)
+  {
+    _value_modifier = vm;
+  }
+
+  // CSV quoting (strings, minimal or all) and separator.
+  void set_csv(const std::string &quoting, const std::string &separator);
+
+  // counter engine, for the jobs output by run() only: the counts are
+  // turned into records there, while spilled, partial, cached and resumed
+  // results hold records.
+  void set_counter(const bool &counter)
+  {
+    _counter = counter;
+  }
+
+  void set_output_shards(output_shards *shards)
+  {
+    _shards = shards;
+  }
+
+  void set_columnar(columnar_file *columnar)
+  {
+    _columnar = columnar;
+  }
+
+  // output run in the background, on the cpus of the stage.
+  void set_output_stage(output_stage *stage)
+  {
+    _stage = stage;
+    _nthreads = stage->ncpu();
+  }
+
+  // memory budget in bytes, 0 for none, and directory of the spilled runs.
+  void set_spill(const size_t &max_memory, const std::string &dir)
+  {
+    _max_memory = max_memory;
+    _spill.set_dir(dir);
   }
 
   void set_defs(const char *fname, const int &nsplit)
@@ -241,12 +539,55 @@ class mr_job : public map_reduce
       delete defs_;
     defs_ = new defsplitter(d,size,nsplit);
   }
+
+  void set_defs(const std::vector<std::string> &files, const int &nsplit)
+  {
+    if (defs_)
+      delete defs_;
+    defs_ = new defsplitter(files,nsplit);
+  }
   
   //private:
   defsplitter *defs_ = nullptr;
   std::string _app_name;
   log_format *_lf = nullptr;
   bool _store_content = false;
+  bool _value_modifier = false; // merge each record into a single one per key and worker
+  bool _counter = false; // count logs per key, records are only built for the output
+  static __thread const char *_counted_line; // line of the key map_counts emits
+  int _nthreads = 0; // output threads, 0 for all cores
+  enum { output_chunk = 1024 }; // records serialized per output task
+  enum { order_none, order_key, order_value_desc };
+  int _order = order_none;
+  int _order_field = -1; // aggregated field to order by, -1 for the count of logs
+  size_t _order_limit = 0; // number of leading records to order, 0 for all
+  csv_writer _csv; // CSV dialect and the columns of the format
+  output_shards *_shards = nullptr; // unordered output written by the reduce tasks
+  columnar_file *_columnar = nullptr; // columnar output, its row groups written in parallel
+  uint64_t _columnar_key = 0; // key of the row groups of the reduce tasks
+  std::atomic<uint64_t> _columnar_seq{0};
+  std::unordered_map<std::thread::id,columnar_group*> _columnar_groups; // row group being filled by each worker
+  std::mutex _columnar_mutex;
+  enum { columnar_rows = 65536 }; // rows per row group of the final output
+  std::atomic<uint64_t> _sampled_records{0}; // records emitted while sampling
+  double _sampled_factor = 0.0; // memory per input byte of the last sample, 0 before any
+  size_t _sampled_nkey = 0; // keys predicted by the last sample
+  size_t _max_memory = 0; // memory budget, aggregated state is spilled beyond half of it
+  spill_runs _spill; // sorted runs of the spilled state
+  output_stage *_stage = nullptr; // pipelined output, nullptr to output in turn
+  pid_t _checkpoint_pid = -1; // child writing the last checkpoint
+  std::string _checkpoint_fname;
+  std::vector<log_record*> _resumed; // records of a checkpoint or of cached files
+  size_t _held_runs = 0; // spilled runs before the results of hold_results
+  size_t _held_compactions = 0;
+  bool _sharded = false;
+  std::string _sharded_format;
+  int _sharded_ndisp = 0;
+  size_t _sharded_keys = 0;
+  size_t _sharded_logs = 0;
+  std::vector<std::string> _sharded_columns; // CSV columns of every shard, when the format has none
+  std::vector<std::pair<double,std::string>> _top; // top records over the shards
+  std::mutex _top_mutex;
   bool _compressed = false;
   bool _quiet = false;
   bool _skip_header = false;
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "output_shards.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  output_shards::~output_shards()
+  {
+    close();
+  }
+  
+  int output_shards::open(const std::string &ofname, const int &nshards)
+  {
+    close();
+    for (int i=0;i<nshards;i++)
+      {
+	std::string fname = nshards == 1 ? ofname : ofname + "." + std::to_string(i);
+	shard *s = new shard();
+	s->_fd = ::open(fname.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+	_shards.push_back(s);
+	if (s->_fd < 0)
+	  {
+	    LOG(ERROR) << "unable to open output file=" << fname << ": " << strerror(errno);
+	    close();
+	    return -1;
+	  }
+      }
+    return 0;
+  }
+
+  void output_shards::close()
+  {
+    for (size_t i=0;i<_shards.size();i++)
+      {
+	if (_shards[i]->_fd >= 0)
+	  ::close(_shards[i]->_fd);
+	delete _shards[i];
+      }
+    _shards.clear();
+  }
+  
+  void output_shards::write(const int &task, const std::string &buf, const std::string &header)
+  {
+    shard *s = _shards[task % _shards.size()];
+    if (!header.empty() && !s->_headed.load(std::memory_order_acquire))
+      {
+	// every writer goes through here before reserving its range, so the
+	// header is at the start of the shard
+	std::lock_guard<std::mutex> lock(s->_header_mutex);
+	if (!s->_headed.load(std::memory_order_relaxed))
+	  {
+	    off_t off = s->_off.fetch_add(header.length());
+	    pwrite_all(s->_fd,header.c_str(),header.length(),off);
+	    s->_headed.store(true,std::memory_order_release);
+	  }
+      }
+    if (buf.empty())
+      return;
+    off_t off = s->_off.fetch_add(buf.length());
+    pwrite_all(s->_fd,buf.c_str(),buf.length(),off);
+  }
+
+  void output_shards::pwrite_all(const int &fd, const char *buf, size_t len, off_t off)
+  {
+    while (len > 0)
+      {
+	ssize_t n = ::pwrite(fd,buf,len,off);
+	if (n < 0)
+	  {
+	    if (errno == EINTR)
+	      continue;
+	    LOG(ERROR) << "error writing output: " << strerror(errno);
+	    return;
+	  }
+	buf += n;
+	len -= n;
+	off += n;
+      }
+  }
+  
+}
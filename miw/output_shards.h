@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OUTPUT_SHARDS_H
+#define OUTPUT_SHARDS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <sys/types.h>
+
+namespace miw
+{
+  /**
+   * Output files written concurrently: writers reserve their range of a
+   * shard with an atomic offset and write it with pwrite. A single shard
+   * writes the output file itself, N shards write ofname.0 to ofname.N-1.
+   */
+  class output_shards
+  {
+  public:
+    output_shards() {}
+    ~output_shards();
+
+    int open(const std::string &ofname, const int &nshards);
+    void close();
+
+    // appends buf to the shard of reduce task task. The header, when not
+    // empty, is written first by the first write to each shard.
+    void write(const int &task, const std::string &buf, const std::string &header="");
+
+    int size() const { return _shards.size(); }
+
+    // writes len bytes of buf at off, resuming interrupted writes.
+    static void pwrite_all(const int &fd, const char *buf, size_t len, off_t off);
+    
+  private:
+    struct shard
+    {
+      int _fd = -1;
+      std::atomic<off_t> _off{0};
+      std::atomic<bool> _headed{false};
+      std::mutex _header_mutex;
+    };
+    std::vector<shard*> _shards;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "output_stage.h"
+#include "cpumap.hh"
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  void output_stage::start(const int &first, const int &ncpu)
+  {
+    if (is_running())
+      return;
+    _first = first;
+    _ncpu = ncpu;
+    _stop = false;
+    _thread = std::thread(&output_stage::loop,this);
+  }
+
+  void output_stage::stop()
+  {
+    if (!is_running())
+      return;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock,[this]{ return !_busy; });
+      _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+  }
+
+  void output_stage::push(const std::function<void()> &task)
+  {
+    if (!is_running())
+      {
+	task();
+	return;
+      }
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock,[this]{ return !_busy; });
+      _task = task;
+      _busy = true;
+    }
+    _cv.notify_all();
+  }
+
+  void output_stage::wait()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock,[this]{ return !_busy; });
+  }
+
+  void output_stage::loop()
+  {
+    // the cpus are left free by the workers, and the output threads of
+    // the tasks inherit them
+    if (!cpumap_pin_range(_first,_ncpu))
+      LOG(WARNING) << "output stage could not be pinned, running unpinned";
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+      {
+	_cv.wait(lock,[this]{ return _busy || _stop; });
+	if (!_busy)
+	  break;
+	lock.unlock();
+	_task();
+	lock.lock();
+	_task = nullptr;
+	_busy = false;
+	_cv.notify_all();
+      }
+  }
+  
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OUTPUT_STAGE_H
+#define OUTPUT_STAGE_H
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace miw
+{
+  /**
+   * Background stage of a pipelined job: runs the output of a file or
+   * chunk while the next one is mapped. It runs one task at a time, on
+   * its own cpus, past the ones of the map reduce workers, and holds at
+   * most one task, so that no more than two sets of results live at once.
+   */
+  class output_stage
+  {
+  public:
+    output_stage() {}
+    ~output_stage() { stop(); }
+
+    // starts the stage thread on ncpu cpus from logical cpu first.
+    void start(const int &first, const int &ncpu);
+
+    // waits for the pending task, if any, then stops the thread.
+    void stop();
+
+    // hands a task to the stage, once the previous one is over.
+    void push(const std::function<void()> &task);
+
+    // waits until the stage has no task left.
+    void wait();
+
+    bool is_running() const { return _thread.joinable(); }
+    int ncpu() const { return _ncpu; }
+    
+  private:
+    void loop();
+    
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::function<void()> _task; // pending or running task
+    bool _busy = false;
+    bool _stop = false;
+    int _first = 0;
+    int _ncpu = 0;
+  };
+
+}
+
+#endif
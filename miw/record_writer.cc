@@ -0,0 +1,484 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "record_writer.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdio.h>
+#include <string.h>
+
+namespace miw
+{
+
+  void record_writer::begin()
+  {
+    _buf.clear();
+    _entries.clear();
+    _in_array = false;
+  }
+
+  void record_writer::key(const std::string &k)
+  {
+    if (!_entries.empty())
+      _entries.back()._vlen = _buf.length() - _entries.back()._voff;
+    entry e;
+    e._koff = _buf.length();
+    e._klen = k.length();
+    _buf += k;
+    e._voff = _buf.length();
+    e._vlen = 0;
+    e._text = false;
+    _entries.push_back(e);
+  }
+
+  void record_writer::sort_entries()
+  {
+    if (_entries.empty())
+      return;
+    _entries.back()._vlen = _buf.length() - _entries.back()._voff;
+    const char *b = _buf.data();
+    std::stable_sort(_entries.begin(),_entries.end(),[b](const entry &e1, const entry &e2)
+		     {
+		       int c = memcmp(b + e1._koff,b + e2._koff,std::min(e1._klen,e2._klen));
+		       return c < 0 || (c == 0 && e1._klen < e2._klen);
+		     });
+    // keep the last value of each key
+    size_t n = 0;
+    for (size_t i=0;i<_entries.size();i++)
+      {
+	if (i + 1 < _entries.size() && _entries[i]._klen == _entries[i+1]._klen
+	    && !memcmp(b + _entries[i]._koff,b + _entries[i+1]._koff,_entries[i]._klen))
+	  continue;
+	_entries[n++] = _entries[i];
+      }
+    _entries.resize(n);
+  }
+
+  void record_writer::write(const Json::Value &jl)
+  {
+    for (Json::ValueConstIterator itr = jl.begin();itr!=jl.end();itr++)
+      {
+	key(itr.key().asString());
+	value_json(*itr);
+      }
+  }
+
+  void record_writer::value_json(const Json::Value &v)
+  {
+    switch (v.type())
+      {
+      case Json::intValue: value_int(v.asLargestInt()); break;
+      case Json::uintValue: value_uint(v.asLargestUInt()); break;
+      case Json::realValue: value_double(v.asDouble()); break;
+      case Json::stringValue: value_string(v.asString()); break;
+      case Json::booleanValue: value_bool(v.asBool()); break;
+      case Json::arrayValue:
+	if (_in_array)
+	  {
+	    value_null();
+	    break;
+	  }
+	begin_array();
+	for (const Json::Value &va : v)
+	  value_json(va);
+	end_array();
+	break;
+      default: value_null(); // nulls and objects
+      }
+  }
+
+  void record_writer::append_uint(std::string &out, unsigned long long v)
+  {
+    char d[24];
+    char *p = d + sizeof(d);
+    do
+      {
+	*--p = '0' + v % 10;
+	v /= 10;
+      }
+    while (v);
+    out.append(p,d + sizeof(d) - p);
+  }
+  
+  void record_writer::append_int(std::string &out, const long long &v)
+  {
+    if (v < 0)
+      {
+	out += '-';
+	append_uint(out,0ULL - static_cast<unsigned long long>(v));
+      }
+    else append_uint(out,v);
+  }
+
+  void json_writer::separate()
+  {
+    if (!_in_array)
+      return;
+    if (_first_elt)
+      _first_elt = false;
+    else _buf += ',';
+  }
+  
+  void json_writer::value_null()
+  {
+    separate();
+    _buf += "null";
+  }
+
+  void json_writer::value_int(const long long &v)
+  {
+    separate();
+    append_int(_buf,v);
+  }
+
+  void json_writer::value_uint(const unsigned long long &v)
+  {
+    separate();
+    append_uint(_buf,v);
+  }
+
+  void json_writer::value_double(const double &v)
+  {
+    separate();
+    append_double(_buf,v);
+  }
+
+  void json_writer::value_bool(const bool &v)
+  {
+    separate();
+    _buf += v ? "true" : "false";
+  }
+
+  void json_writer::value_string(const std::string &v)
+  {
+    separate();
+    append_quoted(_buf,v.data(),v.length());
+  }
+
+  void json_writer::begin_array()
+  {
+    _buf += '[';
+    _in_array = _first_elt = true;
+  }
+
+  void json_writer::end_array()
+  {
+    _buf += ']';
+    _in_array = false;
+  }
+
+  void json_writer::end(std::string &out)
+  {
+    sort_entries();
+    out += '{';
+    for (size_t i=0;i<_entries.size();i++)
+      {
+	const entry &e = _entries[i];
+	if (i)
+	  out += ',';
+	append_quoted(out,_buf.data() + e._koff,e._klen);
+	out += ':';
+	out.append(_buf,e._voff,e._vlen);
+      }
+    out += "}\n";
+    begin();
+  }
+
+  void json_writer::append_double(std::string &out, const double &v)
+  {
+    if (!std::isfinite(v))
+      {
+	out += std::isnan(v) ? "null" : (v < 0 ? "-1e+9999" : "1e+9999");
+	return;
+      }
+    char b[40];
+    int n = snprintf(b,sizeof(b),"%.17g",v);
+    bool has_point = false;
+    for (int i=0;i<n;i++)
+      {
+	if (b[i] == ',')
+	  b[i] = '.';
+	if (b[i] == '.' || b[i] == 'e')
+	  has_point = true;
+      }
+    out.append(b,n);
+    if (!has_point)
+      out += ".0";
+  }
+
+  namespace
+  {
+    // decodes the UTF-8 sequence at s, with the replacement character for
+    // invalid ones, and moves s to its last byte.
+    unsigned int utf8_codepoint(const char *&s, const char *e)
+    {
+      const unsigned int replacement = 0xFFFD;
+      unsigned int b0 = static_cast<unsigned char>(*s);
+      if (b0 < 0x80)
+	return b0;
+      if (b0 < 0xE0)
+	{
+	  if (e - s < 2)
+	    return replacement;
+	  unsigned int c = ((b0 & 0x1F) << 6) | (static_cast<unsigned int>(s[1]) & 0x3F);
+	  s += 1;
+	  return c < 0x80 ? replacement : c;
+	}
+      if (b0 < 0xF0)
+	{
+	  if (e - s < 3)
+	    return replacement;
+	  unsigned int c = ((b0 & 0x0F) << 12) | ((static_cast<unsigned int>(s[1]) & 0x3F) << 6)
+	    | (static_cast<unsigned int>(s[2]) & 0x3F);
+	  s += 2;
+	  if (c >= 0xD800 && c <= 0xDFFF)
+	    return replacement;
+	  return c < 0x800 ? replacement : c;
+	}
+      if (b0 < 0xF8)
+	{
+	  if (e - s < 4)
+	    return replacement;
+	  unsigned int c = ((b0 & 0x07) << 18) | ((static_cast<unsigned int>(s[1]) & 0x3F) << 12)
+	    | ((static_cast<unsigned int>(s[2]) & 0x3F) << 6) | (static_cast<unsigned int>(s[3]) & 0x3F);
+	  s += 3;
+	  return c < 0x10000 ? replacement : c;
+	}
+      return replacement;
+    }
+
+    void append_hex16(std::string &out, const unsigned int &c)
+    {
+      static const char hex[] = "0123456789abcdef";
+      out += "\\u";
+      out += hex[(c >> 12) & 0xF];
+      out += hex[(c >> 8) & 0xF];
+      out += hex[(c >> 4) & 0xF];
+      out += hex[c & 0xF];
+    }
+  }
+  
+  void json_writer::append_quoted(std::string &out, const char *s, const size_t &len)
+  {
+    const char *e = s + len;
+    out += '"';
+    const char *plain = s; // start of the run of characters copied as is
+    for (const char *c = s; c < e; ++c)
+      {
+	unsigned char u = static_cast<unsigned char>(*c);
+	if (u >= 0x20 && u < 0x80 && u != '"' && u != '\\')
+	  continue;
+	out.append(plain,c - plain);
+	switch (u)
+	  {
+	  case '"': out += "\\\""; break;
+	  case '\\': out += "\\\\"; break;
+	  case '\b': out += "\\b"; break;
+	  case '\f': out += "\\f"; break;
+	  case '\n': out += "\\n"; break;
+	  case '\r': out += "\\r"; break;
+	  case '\t': out += "\\t"; break;
+	  default:
+	    {
+	      unsigned int cp = utf8_codepoint(c,e);
+	      if (cp < 0x80 && cp >= 0x20)
+		out += static_cast<char>(cp);
+	      else if (cp < 0x10000)
+		append_hex16(out,cp);
+	      else
+		{
+		  cp -= 0x10000;
+		  append_hex16(out,(cp >> 10) + 0xD800);
+		  append_hex16(out,(cp & 0x3FF) + 0xDC00);
+		}
+	    }
+	  }
+	plain = c + 1;
+      }
+    out.append(plain,e - plain);
+    out += '"';
+  }
+  
+  csv_writer::csv_writer(const char &separator, const int &quoting,
+			 const std::vector<std::string> &columns)
+    :_separator(separator),_quoting(quoting),_columns(columns)
+  {
+  }
+
+  void csv_writer::record_columns()
+  {
+    _columns.clear();
+    for (size_t i=0;i<_entries.size();i++)
+      _columns.push_back(_buf.substr(_entries[i]._koff,_entries[i]._klen));
+    std::sort(_columns.begin(),_columns.end());
+    _columns.erase(std::unique(_columns.begin(),_columns.end()),_columns.end());
+  }
+
+  void csv_writer::header(std::string &out) const
+  {
+    for (size_t i=0;i<_columns.size();i++)
+      {
+	if (i)
+	  out += _separator;
+	append_cell(out,_columns[i].data(),_columns[i].length(),_quoting != quote_strings);
+      }
+    out += '\n';
+  }
+
+  void csv_writer::separate()
+  {
+    if (!_in_array)
+      return;
+    if (_first_elt)
+      _first_elt = false;
+    else _buf += _separator;
+  }
+  
+  void csv_writer::value_null()
+  {
+    separate();
+  }
+
+  void csv_writer::value_int(const long long &v)
+  {
+    separate();
+    append_int(_buf,v);
+  }
+
+  void csv_writer::value_uint(const unsigned long long &v)
+  {
+    separate();
+    append_uint(_buf,v);
+  }
+
+  void csv_writer::value_double(const double &v)
+  {
+    separate();
+    if (v >= INT_MIN && v <= INT_MAX && v == std::floor(v))
+      {
+	append_int(_buf,static_cast<long long>(v));
+	return;
+      }
+    char b[40];
+    int n = snprintf(b,sizeof(b),"%g",v);
+    _buf.append(b,n);
+  }
+
+  void csv_writer::value_bool(const bool &v)
+  {
+    separate();
+    _buf += v ? '1' : '0';
+  }
+
+  void csv_writer::value_string(const std::string &v)
+  {
+    separate();
+    if (!_in_array)
+      {
+	_entries.back()._text = true;
+	_buf += v;
+	return;
+      }
+    // array elements are not quoted
+    for (size_t i=0;i<v.length();i++)
+      if (v[i] != _separator)
+	_buf += v[i];
+  }
+
+  void csv_writer::begin_array()
+  {
+    _entries.back()._text = true;
+    _buf += '[';
+    _in_array = _first_elt = true;
+  }
+
+  void csv_writer::end_array()
+  {
+    _buf += ']';
+    _in_array = false;
+  }
+
+  void csv_writer::end(std::string &out)
+  {
+    sort_entries();
+    // keys and columns are both in order
+    const char *b = _buf.data();
+    size_t j = 0;
+    for (size_t i=0;i<_columns.size();i++)
+      {
+	if (i)
+	  out += _separator;
+	const std::string &c = _columns[i];
+	int cmp = -1;
+	while (j < _entries.size())
+	  {
+	    const entry &e = _entries[j];
+	    cmp = memcmp(b + e._koff,c.data(),std::min(e._klen,c.length()));
+	    if (cmp == 0)
+	      cmp = e._klen < c.length() ? -1 : e._klen > c.length() ? 1 : 0;
+	    if (cmp >= 0)
+	      break;
+	    ++j; // not a column
+	  }
+	if (cmp == 0)
+	  {
+	    const entry &e = _entries[j++];
+	    append_cell(out,b + e._voff,e._vlen,e._text);
+	  }
+      }
+    out += '\n';
+    begin();
+  }
+
+  void csv_writer::append_cell(std::string &out, const char *s, const size_t &len,
+			       const bool &text) const
+  {
+    bool quote = false;
+    if (_quoting == quote_all)
+      quote = text || len > 0;
+    else if (_quoting == quote_strings)
+      quote = text;
+    else
+      for (size_t i=0;i<len && !quote;i++)
+	quote = s[i] == _separator || s[i] == '"' || s[i] == '\n' || s[i] == '\r';
+    if (!quote)
+      {
+	out.append(s,len);
+	return;
+      }
+    out += '"';
+    for (size_t i=0;i<len;i++)
+      {
+	if (s[i] == '"')
+	  out += '"';
+	out += s[i];
+      }
+    out += '"';
+  }
+}
@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RECORD_WRITER_H
+#define RECORD_WRITER_H
+
+#include <string>
+#include <vector>
+#include <jsoncpp/json/json.h>
+
+namespace miw
+{
+  /**
+   * Streaming serialization of log records, without building a Json::Value:
+   * the record pushes the typed values of its keys and the writer formats
+   * them into a buffer reused from record to record. Keys are output in
+   * order, the last value of a key winning, as in a jsoncpp object, so that
+   * the output is the one of the record's to_json.
+   */
+  class record_writer
+  {
+  public:
+    virtual ~record_writer() {}
+
+    // starts a new record, dropping any unfinished one.
+    virtual void begin();
+
+    // starts the value of key k.
+    virtual void key(const std::string &k);
+    
+    virtual void value_null() = 0;
+    virtual void value_int(const long long &v) = 0;
+    virtual void value_uint(const unsigned long long &v) = 0;
+    virtual void value_double(const double &v) = 0;
+    virtual void value_bool(const bool &v) = 0;
+    virtual void value_string(const std::string &v) = 0;
+    virtual void begin_array() = 0;
+    virtual void end_array() = 0;
+
+    // appends the record to out.
+    virtual void end(std::string &out) = 0;
+
+    // members of a to_json record, for the records that cannot write
+    // themselves. Objects are written as nulls.
+    void write(const Json::Value &jl);
+
+    // integer formatting.
+    static void append_int(std::string &out, const long long &v);
+    static void append_uint(std::string &out, unsigned long long v);
+    
+  protected:
+    struct entry
+    {
+      size_t _koff;
+      size_t _klen;
+      size_t _voff;
+      size_t _vlen;
+      bool _text; /**< string or array value */
+    };
+
+    // entries of the record in key order, without duplicates.
+    void sort_entries();
+
+    void value_json(const Json::Value &v);
+
+    std::string _buf; /**< keys and values of the current record */
+    std::vector<entry> _entries;
+    bool _in_array = false;
+    bool _first_elt = false; /**< whether the next array element is the first one */
+  };
+
+  /**
+   * JSON lines, byte for byte as Json::FastWriter writes them.
+   */
+  class json_writer : public record_writer
+  {
+  public:
+    void value_null();
+    void value_int(const long long &v);
+    void value_uint(const unsigned long long &v);
+    void value_double(const double &v);
+    void value_bool(const bool &v);
+    void value_string(const std::string &v);
+    void begin_array();
+    void end_array();
+    void end(std::string &out);
+
+    // escaped and quoted string.
+    static void append_quoted(std::string &out, const char *s, const size_t &len);
+    static void append_double(std::string &out, const double &v);
+
+  private:
+    void separate();
+  };
+
+  /**
+   * CSV lines over a fixed set of columns, a record leaving the cells of
+   * its missing keys empty. Numbers are written as json_to_csv did, i.e.
+   * integral values as integers and others in %g, booleans as 1 or 0, and
+   * arrays as "[a,b]" with the separator removed from their strings.
+   */
+  class csv_writer : public record_writer
+  {
+  public:
+    enum { quote_strings, quote_minimal, quote_all };
+
+    // columns must be sorted, an empty set taking the keys of the first
+    // record with record_columns().
+    csv_writer(const char &separator=',', const int &quoting=quote_strings,
+	       const std::vector<std::string> &columns=std::vector<std::string>());
+
+    bool has_columns() const { return !_columns.empty(); }
+    const std::vector<std::string>& columns() const { return _columns; }
+    void set_columns(const std::vector<std::string> &columns) { _columns = columns; }
+
+    // uses the keys of the current record as the columns.
+    void record_columns();
+
+    // appends the header line.
+    void header(std::string &out) const;
+    
+    void value_null();
+    void value_int(const long long &v);
+    void value_uint(const unsigned long long &v);
+    void value_double(const double &v);
+    void value_bool(const bool &v);
+    void value_string(const std::string &v);
+    void begin_array();
+    void end_array();
+    void end(std::string &out);
+    
+  private:
+    void separate();
+    void append_cell(std::string &out, const char *s, const size_t &len, const bool &text) const;
+
+    char _separator = ',';
+    int _quoting = quote_strings;
+    std::vector<std::string> _columns;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "spill.h"
+#include <algorithm>
+#include <fstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glog/logging.h>
+
+namespace miw
+{
+
+  spill_runs::~spill_runs()
+  {
+    close();
+  }
+
+  bool spill_runs::key_less(const std::string &k1, const std::string &k2)
+  {
+    return strcasecmp(k1.c_str(),k2.c_str()) < 0;
+  }
+
+  bool spill_runs::key_equal(const std::string &k1, const std::string &k2)
+  {
+    return strcasecmp(k1.c_str(),k2.c_str()) == 0;
+  }
+
+  size_t spill_runs::resident_memory()
+  {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if (!(statm >> size >> resident))
+      return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  FILE* spill_runs::open_run()
+  {
+    std::string dir = _dir;
+    if (dir.empty())
+      {
+	const char *tmpdir = getenv("TMPDIR");
+	dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+      }
+    std::string tmpl = dir + "/miw_spill_XXXXXX";
+    std::vector<char> fname(tmpl.begin(),tmpl.end());
+    fname.push_back('\0');
+    int fd = mkstemp(fname.data());
+    if (fd < 0)
+      {
+	LOG(ERROR) << "unable to create spill file in " << dir << ": " << strerror(errno);
+	return nullptr;
+      }
+    unlink(fname.data()); // the run goes away with its descriptor
+    FILE *f = fdopen(fd,"w+");
+    if (!f)
+      {
+	LOG(ERROR) << "unable to open spill file: " << strerror(errno);
+	::close(fd);
+	return nullptr;
+      }
+    setvbuf(f,nullptr,_IOFBF,1<<20);
+    return f;
+  }
+
+  bool spill_runs::write_record(FILE *f, log_record *lr, std::string &buf)
+  {
+    buf.clear();
+    lr->serialize(buf);
+    uint32_t len = buf.length();
+    return fwrite(&len,sizeof(len),1,f) == 1
+      && fwrite(buf.data(),1,buf.length(),f) == buf.length();
+  }
+
+  log_record* spill_runs::read_record(FILE *f, std::string &buf, int &err)
+  {
+    uint32_t len = 0;
+    if (fread(&len,sizeof(len),1,f) != 1)
+      {
+	if (ferror(f))
+	  {
+	    LOG(ERROR) << "unable to read spill file: " << strerror(errno);
+	    err = -1;
+	  }
+	return nullptr;
+      }
+    buf.resize(len);
+    log_record *lr = nullptr;
+    if (fread(&buf[0],1,len,f) == len)
+      lr = log_record::unserialize(buf.data(),len);
+    if (!lr)
+      {
+	LOG(ERROR) << "truncated or malformed spill file";
+	err = -1;
+      }
+    return lr;
+  }
+
+  int spill_runs::write_run(FILE *f, const size_t &nrecords)
+  {
+    if (fflush(f) != 0 || ferror(f))
+      {
+	LOG(ERROR) << "unable to write spill file: " << strerror(errno);
+	fclose(f);
+	return -1;
+      }
+    run r;
+    r._f = f;
+    r._records = nrecords;
+    _runs.push_back(r);
+    return 0;
+  }
+  
+  int spill_runs::spill(std::vector<log_record*> &records)
+  {
+    std::sort(records.begin(),records.end(),[](log_record *lr1, log_record *lr2)
+	      {
+		return key_less(lr1->_key,lr2->_key);
+	      });
+    FILE *f = open_run();
+    if (!f)
+      return -1;
+    std::string buf;
+    for (size_t i=0;i<records.size();i++)
+      if (!write_record(f,records.at(i),buf))
+	break;
+    if (write_run(f,records.size()) < 0)
+      return -1;
+    if (_runs.size() <= max_runs)
+      return 0;
+
+    // too many runs to merge at once, they are merged into a single one.
+    // The records are on disk by now: on error, the runs are kept as is.
+    f = open_run();
+    if (!f)
+      return 0;
+    size_t n = 0;
+    bool written = true;
+    int err = merge([&](log_record *lr)
+		    {
+		      written = write_record(f,lr,buf);
+		      delete lr;
+		      ++n;
+		      return written;
+		    });
+    if (err < 0 || !written || fflush(f) != 0)
+      {
+	LOG(ERROR) << "unable to merge spill files: " << strerror(errno);
+	fclose(f);
+	return 0;
+      }
+    close();
+    ++_compactions;
+    return write_run(f,n);
+  }
+
+  int spill_runs::add(const std::string &fname)
+  {
+    FILE *f = fopen(fname.c_str(),"r");
+    if (!f)
+      {
+	LOG(ERROR) << "unable to open run file " << fname << ": " << strerror(errno);
+	return -1;
+      }
+    unlink(fname.c_str());
+    setvbuf(f,nullptr,_IOFBF,1<<20);
+    run r;
+    r._f = f;
+    _runs.push_back(r);
+    return 0;
+  }
+
+  int spill_runs::merge(const std::function<bool(log_record*)> &out,
+			 const std::vector<log_record*> &held)
+  {
+    // heap of the next record of every run, the records of a key being
+    // merged in run order
+    struct head
+    {
+      log_record *_lr;
+      size_t _run;
+    };
+    auto greater = [](const head &h1, const head &h2)
+      {
+	int c = strcasecmp(h1._lr->_key.c_str(),h2._lr->_key.c_str());
+	if (c != 0)
+	  return c > 0;
+	return h1._run > h2._run;
+      };
+    std::vector<head> heads;
+    std::string buf;
+    int err = 0;
+    size_t nheld = 0;
+    auto next = [&](const size_t &r)
+      {
+	log_record *lr = nullptr;
+	if (r < _runs.size())
+	  lr = read_record(_runs.at(r)._f,buf,err);
+	else if (nheld < held.size())
+	  {
+	    buf.clear();
+	    held.at(nheld++)->serialize(buf);
+	    lr = log_record::unserialize(buf.data(),buf.length());
+	  }
+	if (!lr)
+	  return;
+	head h;
+	h._lr = lr;
+	h._run = r;
+	heads.push_back(h);
+	std::push_heap(heads.begin(),heads.end(),greater);
+      };
+    for (size_t r=0;r<_runs.size();r++)
+      {
+	rewind(_runs.at(r)._f);
+	next(r);
+      }
+    next(_runs.size());
+    while(!heads.empty() && err == 0)
+      {
+	std::pop_heap(heads.begin(),heads.end(),greater);
+	head h = heads.back();
+	heads.pop_back();
+	next(h._run);
+	while(!heads.empty() && key_equal(heads.front()._lr->_key,h._lr->_key))
+	  {
+	    std::pop_heap(heads.begin(),heads.end(),greater);
+	    head h2 = heads.back();
+	    heads.pop_back();
+	    h._lr->merge(h2._lr);
+	    delete h2._lr;
+	    next(h2._run);
+	  }
+	if (!out(h._lr))
+	  break;
+      }
+    for (size_t i=0;i<heads.size();i++)
+      delete heads.at(i)._lr;
+    return err;
+  }
+
+  int spill_runs::copy_runs(FILE *out, const size_t &first) const
+  {
+    std::vector<char> buf(1<<20);
+    for (size_t r=first;r<_runs.size();r++)
+      {
+	int fd = fileno(_runs.at(r)._f);
+	off_t off = 0;
+	ssize_t n;
+	while ((n = pread(fd,buf.data(),buf.size(),off)) > 0)
+	  {
+	    if (fwrite(buf.data(),1,n,out) != (size_t)n)
+	      return -1;
+	    off += n;
+	  }
+	if (n < 0)
+	  return -1;
+      }
+    return 0;
+  }
+
+  void spill_runs::close()
+  {
+    for (size_t r=0;r<_runs.size();r++)
+      fclose(_runs.at(r)._f);
+    _runs.clear();
+  }
+
+  size_t spill_runs::records() const
+  {
+    size_t n = 0;
+    for (size_t r=0;r<_runs.size();r++)
+      n += _runs.at(r)._records;
+    return n;
+  }
+  
+}
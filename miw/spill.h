@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2015 SopraSteria
+ * All rights reserved.
+ * Author: Emmanuel Benazera <emmanuel.benazera@deepdetect.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of SopraSteria nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY SOPRASTERIA ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SOPRASTERIA BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include "log_record.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdio.h>
+
+namespace miw
+{
+  /**
+   * Aggregated records spilled to disk under a memory budget. Each spill
+   * writes the records, sorted by key, to a run file, unlinked as soon as
+   * it is created, and the runs are merged back in key order, the records
+   * of a key being merged over the runs. Keys are ordered and compared as
+   * by mr_job::key_compare, with strcasecmp, so that the order matches the
+   * key order of the output and the keys merged in memory are merged over
+   * the runs as well.
+   */
+  class spill_runs
+  {
+  public:
+    spill_runs() {}
+    ~spill_runs();
+
+    // directory of the run files, TMPDIR or /tmp when empty.
+    void set_dir(const std::string &dir) { _dir = dir; }
+
+    // writes the records as a new run, sorting them in place. The records
+    // are left to the caller. -1 on error.
+    int spill(std::vector<log_record*> &records);
+
+    // adds the records of fname, sorted by key in the form of the runs,
+    // as a new run. The file is removed once open. -1 on error.
+    int add(const std::string &fname);
+
+    // calls out with the merged record of every key of the runs, in key
+    // order, until out returns false. The records are owned by out.
+    // held, sorted by key, are records that could not be spilled: they are
+    // merged as the last run, out getting copies of them.
+    int merge(const std::function<bool(log_record*)> &out,
+	      const std::vector<log_record*> &held=std::vector<log_record*>());
+
+    // removes all the runs.
+    void close();
+
+    size_t size() const { return _runs.size(); }
+    size_t records() const;
+
+    // appends the records of the runs from first on to out, as they are
+    // on disk. The runs are read with pread, leaving alone the file
+    // offsets that a forked child shares with its parent. -1 on error.
+    int copy_runs(FILE *out, const size_t &first=0) const;
+
+    // number of times the runs were merged into a single one.
+    size_t compactions() const { return _compactions; }
+
+    static bool key_less(const std::string &k1, const std::string &k2);
+    static bool key_equal(const std::string &k1, const std::string &k2);
+
+    // record in the binary form of the runs: its length, then
+    // log_record::serialize.
+    static bool write_record(FILE *f, log_record *lr, std::string &buf);
+
+    // next record of f, nullptr at its end or on error, err being then set.
+    static log_record* read_record(FILE *f, std::string &buf, int &err);
+
+    // resident memory of the process, in bytes.
+    static size_t resident_memory();
+    
+  private:
+    FILE* open_run();
+    int write_run(FILE *f, const size_t &nrecords);
+
+    struct run
+    {
+      FILE *_f = nullptr;
+      size_t _records = 0;
+    };
+    std::vector<run> _runs;
+    size_t _compactions = 0;
+    std::string _dir;
+    enum { max_runs = 64 }; // runs merged into one beyond this number
+  };
+  
+}
+
+#endif
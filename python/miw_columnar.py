@@ -0,0 +1,141 @@
+import json
+import mmap
+import struct
+
+# reader of the columnar output of miw (-output_format columnar), see
+# miw/columnar.h for the layout. Columns are memoryviews over the mapped
+# file, or numpy arrays sharing its memory when numpy is available.
+
+MAGIC = b'MIWCOL01'
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+_formats = {'int64': ('q', 8), 'float64': ('d', 8), 'bool': ('B', 1), 'string': ('I', 4)}
+
+class Column:
+
+    def __init__(self, name, rows, meta, buf):
+        self.name = name
+        self.rows = rows
+        self.type = meta['type']
+        self.union = meta['union']
+        self.nulls = meta['nulls']
+        self.stats = dict((k, meta[k]) for k in ('min', 'max', 'distinct') if k in meta)
+        self.validity = self._buffer(meta, buf, 'validity', 'B')
+        self.offsets = self._buffer(meta, buf, 'offsets', 'I')
+        self.values = self._buffer(meta, buf, 'values', _formats.get(self.type, ('B', 1))[0])
+        self._dict_offsets = self._buffer(meta, buf, 'dict_offsets', 'I')
+        self._dict_values = self._buffer(meta, buf, 'dict_values', 'B')
+        self._dictionary = None
+
+    @staticmethod
+    def _buffer(meta, buf, name, fmt):
+        if name not in meta:
+            return None
+        off, length = meta[name]
+        view = buf[off:off + length]
+        if numpy is not None:
+            return numpy.frombuffer(view, dtype=fmt)
+        return view.cast(fmt)
+
+    def dictionary(self):
+        """strings of the dictionary of a string column, decoded once"""
+        if self._dictionary is None:
+            self._dictionary = []
+            if self._dict_offsets is not None:
+                data = bytes(self._dict_values) if self._dict_values is not None else b''
+                o = self._dict_offsets
+                self._dictionary = [data[o[i]:o[i + 1]].decode('utf-8', 'replace')
+                                    for i in range(len(o) - 1)]
+        return self._dictionary
+
+    def is_null(self, r):
+        if self.type == 'null':
+            return True
+        return self.validity is not None and not (self.validity[r >> 3] >> (r & 7)) & 1
+
+    def value(self, r):
+        """python value of row r: None, a scalar, or a list for union columns"""
+        if self.is_null(r):
+            return None
+        if self.offsets is not None:
+            return [self._element(i) for i in range(self.offsets[r], self.offsets[r + 1])]
+        return self._element(r)
+
+    def _element(self, i):
+        v = self.values[i]
+        if self.type == 'string':
+            return self.dictionary()[v]
+        if self.type == 'bool':
+            return bool(v)
+        if numpy is not None:
+            return v.item()
+        return v
+
+    def to_list(self):
+        return [self.value(r) for r in range(self.rows)]
+
+class ColumnarFile:
+
+    def __init__(self, fname):
+        self._file = open(fname, 'rb')
+        self._map = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        size = len(self._map)
+        if size < 24 or self._map[:8] != MAGIC or self._map[size - 8:] != MAGIC:
+            raise ValueError('not a miw columnar file: %s' % fname)
+        flen = struct.unpack('<Q', self._map[size - 16:size - 8])[0]
+        self.footer = json.loads(self._map[size - 16 - flen:size - 16].decode('utf-8'))
+        self.rows = self.footer['num_rows']
+        self.columns = self.footer['columns']
+        self.row_groups = self.footer['row_groups']
+        self._view = memoryview(self._map)
+
+    def close(self):
+        self._view.release()
+        self._map.close()
+        self._file.close()
+
+    def column(self, name, group):
+        """column name of row group group, None if no row of the group has it"""
+        g = self.row_groups[group]
+        meta = g['columns'].get(name)
+        if meta is None:
+            return None
+        buf = self._view[g['offset']:g['offset'] + g['length']]
+        return Column(name, g['num_rows'], meta, buf)
+
+    def records(self):
+        """rows as dictionaries, without their null values"""
+        for gi, g in enumerate(self.row_groups):
+            cols = [self.column(n, gi) for n in sorted(g['columns'])]
+            for r in range(g['num_rows']):
+                rec = {}
+                for c in cols:
+                    v = c.value(r)
+                    if v is not None:
+                        rec[c.name] = v
+                yield rec
+
+    def to_pandas(self):
+        """data frame of the scalar columns, unions as lists"""
+        import pandas
+        frames = []
+        for gi, g in enumerate(self.row_groups):
+            data = {}
+            for n in self.columns:
+                c = self.column(n, gi)
+                if c is None:
+                    data[n] = [None] * g['num_rows']
+                elif c.type in ('int64', 'float64') and not c.union and c.nulls == 0:
+                    data[n] = c.values
+                elif c.type == 'string' and not c.union and c.nulls == 0:
+                    data[n] = pandas.Categorical.from_codes(c.values.astype('int64'), c.dictionary())
+                else:
+                    data[n] = c.to_list()
+            frames.append(pandas.DataFrame(data))
+        if not frames:
+            return pandas.DataFrame(columns=self.columns)
+        return pandas.concat(frames, ignore_index=True)
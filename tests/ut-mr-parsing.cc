@@ -28,7 +28,10 @@
 
 #include "job.h"
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 using namespace miw;
 
@@ -433,3 +436,796 @@ TEST(job,testMatchRatio)
   ASSERT_NE(first_line.find("\"iratio\":0.57142859697341919"), std::string::npos);
   ASSERT_NE(first_line.find("\"tratio\":2.6666667461395264"), std::string::npos);
 }
+
+TEST(job,testMergeFiles)
+{
+  google::FlagSaver flag_saver;
+  job j;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // three inputs, two of them from a glob pattern, merged in a single run
+  std::string arg_line = "-fnames ../data/tests/sum.log,../data/tests/sum*.log -format_name ../miw/formats/tests/sum -output_format json -map_tasks 2 -merge_results -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  if (!jsonfile.good())
+    remove(tmp_outputfile);
+  ASSERT_EQ(true, jsonfile.good());
+
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+
+  remove(tmp_outputfile);
+
+  ASSERT_EQ(3,j._files.size());
+  ASSERT_EQ("../data/tests/sum2.log",j._files.at(2));
+  ASSERT_NE(first_line.find("\"logs\":14"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":38"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v2\":40"), std::string::npos);
+}
+
+TEST(job,testMergeDirectory)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+  char dir[] = "/tmp/miw_dirXXXXXX";
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  ASSERT_NE(NULL, mkdtemp(dir));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // the regular files of a directory, in name order, without the hidden
+  // ones and the subdirectories
+  std::string d = dir;
+  std::string copies[3][2] = { { "../data/tests/sum.log", d + "/a.log" },
+			       { "../data/tests/sum2.log", d + "/b.log" },
+			       { "../data/tests/sum.log", d + "/.hidden.log" } };
+  for (int i=0;i<3;i++)
+    {
+      std::ifstream in(copies[i][0]);
+      std::ofstream out(copies[i][1]);
+      out << in.rdbuf();
+    }
+  ASSERT_EQ(0, mkdir((d + "/sub").c_str(),0700));
+
+  std::string arg_line = "-fnames " + d + " -format_name ../miw/formats/tests/sum -output_format json -merge_results -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  job j;
+  j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+  remove(tmp_outputfile);
+  ASSERT_EQ(0, system(("rm -rf " + d).c_str()));
+
+  ASSERT_EQ(2,j._files.size());
+  ASSERT_EQ(d + "/a.log",j._files.at(0));
+  ASSERT_EQ(d + "/b.log",j._files.at(1));
+  ASSERT_NE(first_line.find("\"logs\":8"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":22"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v2\":23"), std::string::npos);
+}
+
+TEST(job,testValueModifier)
+{
+  google::FlagSaver flag_saver;
+  job j;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  std::string arg_line = "-fnames ../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format json -map_tasks 2 -merge_results=false -value_modifier -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  if (!jsonfile.good())
+    remove(tmp_outputfile);
+  ASSERT_EQ(true, jsonfile.good());
+
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+
+  remove(tmp_outputfile);
+
+  ASSERT_TRUE(j._value_modifier);
+  ASSERT_NE(first_line.find("\"logs\":6"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":16"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v2\":17"), std::string::npos);
+}
+
+TEST(job,testValueModifierSplits)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+  char log_file[] = "/tmp/miw_vmXXXXXX";
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  int fd = mkstemp(log_file);
+  ASSERT_TRUE(fd >= 0);
+  close(fd);
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // keys repeated all over the file, in the sampled split and in the
+  // splits of the map phase
+  int v1[3] = { 0, 0, 0 };
+  {
+    std::ofstream out(log_file);
+    for (int i=0;i<300;i++)
+      {
+	out << i % 3 + 1 << "," << i % 7 << "," << i % 4 << ".5\n";
+	v1[i % 3] += i % 7;
+      }
+  }
+
+  std::string outputs[2];
+  for (int r=0;r<2;r++)
+    {
+      std::string arg_line = "-fnames ";
+      arg_line.append(log_file);
+      arg_line.append(" -format_name ../miw/formats/tests/sum -output_format json -map_tasks 4 -order key -value_modifier=");
+      arg_line.append(r == 0 ? "true" : "false");
+      arg_line.append(" -ofname ");
+      arg_line.append(tmp_outputfile);
+      std::vector<std::string> args;
+      log_format::tokenize(arg_line,-1,args," ","");
+      char* cargs[args.size()+1];
+      cargs[0] = "miw";
+      for (size_t i=0;i<args.size();i++)
+	cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+      job j;
+      j.execute(args.size()+1,cargs);
+      ASSERT_EQ(r == 0, j._value_modifier);
+
+      std::ifstream jsonfile(tmp_outputfile);
+      outputs[r].assign((std::istreambuf_iterator<char>(jsonfile)),std::istreambuf_iterator<char>());
+      remove(tmp_outputfile);
+    }
+  remove(log_file);
+
+  for (int k=0;k<3;k++)
+    {
+      std::string record = "\"id\":" + std::to_string(k+1) + ",\"logs\":100,";
+      size_t pos = outputs[0].find(record);
+      ASSERT_NE(std::string::npos, pos);
+      std::string line = outputs[0].substr(pos,outputs[0].find('\n',pos) - pos);
+      ASSERT_NE(std::string::npos, line.find("\"v1\":" + std::to_string(v1[k]) + ","));
+    }
+  ASSERT_EQ(outputs[1], outputs[0]);
+}
+
+TEST(job,testOrder)
+{
+  google::FlagSaver flag_saver;
+  std::string orders[2] = { "count", "v1" };
+  std::string firsts[2] = { "\"id\":2", "\"id\":1" };
+  for (int o=0;o<2;o++)
+    {
+      job j;
+      char tmp_outputfile[L_tmpnam];
+
+      ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+      std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+      std::string arg_line = "-fnames ../data/tests/order.log -format_name ../miw/formats/tests/sum -output_format json -map_tasks 2 -merge_results=false -value_modifier=false -order_limit 0 -order " + orders[o] + " -ofname ";
+      arg_line.append(tmp_outputfile);
+      std::vector<std::string> args;
+      log_format::tokenize(arg_line,-1,args," ","");
+      char* cargs[args.size()+1];
+      cargs[0] = "miw";
+      for (size_t i=0;i<args.size();i++)
+	cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+      j.execute(args.size()+1,cargs);
+
+      std::ifstream jsonfile(tmp_outputfile);
+      if (!jsonfile.good())
+	remove(tmp_outputfile);
+      ASSERT_EQ(true, jsonfile.good());
+
+      std::string first_line;
+      std::getline(jsonfile, first_line);
+
+      remove(tmp_outputfile);
+
+      ASSERT_NE(first_line.find(firsts[o]), std::string::npos);
+    }
+}
+
+TEST(job,testCsv)
+{
+  google::FlagSaver flag_saver;
+  job j;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  std::string arg_line = "-fnames ../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format csv -merge_results=false -order none -csv_quoting minimal -csv_separator ; -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  j.execute(args.size()+1,cargs);
+
+  std::ifstream csvfile(tmp_outputfile);
+  if (!csvfile.good())
+    remove(tmp_outputfile);
+  ASSERT_EQ(true, csvfile.good());
+
+  std::string header, line;
+  std::getline(csvfile, header);
+  std::getline(csvfile, line);
+
+  remove(tmp_outputfile);
+
+  ASSERT_EQ("format_name;id;logs;std_date_dt;v1;v2", header);
+  ASSERT_EQ("sum;1;6;0000-00-00T00:00:00Z;16;17", line);
+}
+
+TEST(job,testColumnar)
+{
+  google::FlagSaver flag_saver;
+  job j;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  std::string arg_line = "-fnames ../data/tests/order.log -format_name ../miw/formats/tests/sum -output_format columnar -merge_results=false -order key -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  j.execute(args.size()+1,cargs);
+
+  columnar_reader cr;
+  int err = cr.open(tmp_outputfile);
+  remove(tmp_outputfile);
+  ASSERT_EQ(0, err);
+  ASSERT_EQ(3, cr.rows());
+  ASSERT_EQ(1, cr.groups());
+
+  column_view id, logs, name;
+  ASSERT_TRUE(cr.column(0,"id",id));
+  ASSERT_TRUE(cr.column(0,"logs",logs));
+  ASSERT_TRUE(cr.column(0,"format_name",name));
+  ASSERT_EQ("int64", id._type);
+  ASSERT_EQ(1, id.int64(0));
+  ASSERT_EQ(3, id.int64(2));
+  ASSERT_EQ(1, logs.int64(0));
+  ASSERT_EQ(3, logs.int64(1));
+  ASSERT_EQ("string", name._type);
+  ASSERT_EQ("sum", name.str(1));
+  ASSERT_FALSE(name.is_null(0));
+}
+
+TEST(job,testSpill)
+{
+  google::FlagSaver flag_saver;
+  job j;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // a budget below the resident memory spills the results after every file
+  std::string arg_line = "-fnames ../data/tests/sum.log,../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format json -merge_results -max_memory 1 -order key -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  if (!jsonfile.good())
+    remove(tmp_outputfile);
+  ASSERT_EQ(true, jsonfile.good());
+
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+
+  remove(tmp_outputfile);
+
+  ASSERT_TRUE(j._autosplit);
+  ASSERT_NE(first_line.find("\"logs\":12"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":32"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v2\":34"), std::string::npos);
+}
+
+TEST(job,testPipelinedOutput)
+{
+  google::FlagSaver flag_saver;
+  job j;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // the results of the first file are written while the second one is processed
+  std::string arg_line = "-fnames ../data/tests/sum.log,../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format json -merge_results=false -max_memory 0 -output_cores 1 -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  if (!jsonfile.good())
+    remove(tmp_outputfile);
+  ASSERT_EQ(true, jsonfile.good());
+
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(jsonfile, line))
+    lines.push_back(line);
+
+  remove(tmp_outputfile);
+
+  ASSERT_FALSE(j._stage.is_running());
+  ASSERT_EQ(2,lines.size());
+  for (size_t i=0;i<lines.size();i++)
+    {
+      ASSERT_NE(lines[i].find("\"logs\":6"), std::string::npos);
+      ASSERT_NE(lines[i].find("\"v1\":16"), std::string::npos);
+    }
+}
+
+TEST(job,testCheckpoint)
+{
+  google::FlagSaver flag_saver;
+
+  // with -autosplit, and with -tmp_save alone turning it on
+  std::string autosplit[2] = { " -autosplit", "" };
+  for (int r=0;r<2;r++)
+    {
+      char tmp_outputfile[L_tmpnam];
+      char dir[] = "/tmp/miw_ckptXXXXXX";
+
+      ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+      ASSERT_NE(NULL, mkdtemp(dir));
+      std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+      std::string ckpt = std::string(tmp_outputfile) + ".ckpt";
+      std::string d = dir;
+      std::string fnames[3] = { d + "/a.log", d + "/b.log", d + "/c.log" };
+      for (int i=0;i<3;i++)
+	{
+	  std::ifstream in("../data/tests/sum.log");
+	  std::ofstream out(fnames[i]);
+	  out << in.rdbuf();
+	}
+
+      // the checkpoint after the second file covers two of them
+      std::string arg_line = "-fnames " + fnames[0] + "," + fnames[1] + "," + fnames[2] + " -format_name ../miw/formats/tests/sum -output_format json -merge_results" + autosplit[r] + " -output_cores 0 -tmp_save -ofname ";
+      arg_line.append(tmp_outputfile);
+      std::vector<std::string> args;
+      log_format::tokenize(arg_line,-1,args," ","");
+      char* cargs[args.size()+1];
+      cargs[0] = "miw";
+      for (size_t i=0;i<args.size();i++)
+	cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+      {
+	google::FlagSaver first_flags;
+	job j;
+	j.execute(args.size()+1,cargs);
+      }
+      remove(tmp_outputfile);
+
+      // resuming from it with the same arguments only processes the third
+      // file: the first one, emptied, still counts
+      std::ofstream(fnames[0].c_str(),std::ios::trunc);
+      std::string resume_line = arg_line + " -resume " + ckpt;
+      std::vector<std::string> rargs;
+      log_format::tokenize(resume_line,-1,rargs," ","");
+      char* crargs[rargs.size()+1];
+      crargs[0] = "miw";
+      for (size_t i=0;i<rargs.size();i++)
+	crargs[i+1] = const_cast<char*>(rargs.at(i).c_str());
+      int status;
+      {
+	google::FlagSaver resume_flags;
+	job j;
+	status = j.execute(rargs.size()+1,crargs);
+      }
+      remove(ckpt.c_str());
+      ASSERT_EQ(0, system(("rm -rf " + d).c_str()));
+
+      std::ifstream jsonfile(tmp_outputfile);
+      if (!jsonfile.good())
+	remove(tmp_outputfile);
+      ASSERT_EQ(true, jsonfile.good());
+
+      std::string first_line;
+      std::getline(jsonfile, first_line);
+
+      remove(tmp_outputfile);
+
+      ASSERT_EQ(0, status);
+      ASSERT_NE(first_line.find("\"logs\":18"), std::string::npos);
+      ASSERT_NE(first_line.find("\"v1\":48"), std::string::npos);
+    }
+}
+
+TEST(job,testFileCache)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+  char cache_dir[] = "/tmp/miw_cacheXXXXXX";
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  ASSERT_NE(NULL, mkdtemp(cache_dir));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // the first job caches the results of the file, the second one reads
+  // them twice instead of processing it
+  std::string fnames[2] = { "../data/tests/sum.log", "../data/tests/sum.log,../data/tests/sum.log" };
+  job *jobs[2];
+  for (int r=0;r<2;r++)
+    {
+      std::string arg_line = "-fnames " + fnames[r] + " -format_name ../miw/formats/tests/sum -output_format json -merge_results -cache_dir ";
+      arg_line.append(cache_dir);
+      arg_line.append(" -ofname ");
+      arg_line.append(tmp_outputfile);
+      std::vector<std::string> args;
+      log_format::tokenize(arg_line,-1,args," ","");
+      char* cargs[args.size()+1];
+      cargs[0] = "miw";
+      for (size_t i=0;i<args.size();i++)
+	cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+      jobs[r] = new job();
+      jobs[r]->execute(args.size()+1,cargs);
+    }
+  bool cached = jobs[1]->_cache.is_open() && !jobs[1]->_caching;
+  delete jobs[0];
+  delete jobs[1];
+
+  std::ifstream jsonfile(tmp_outputfile);
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+  remove(tmp_outputfile);
+
+  std::string entries = "rm -rf ";
+  entries.append(cache_dir);
+  ASSERT_EQ(0, system(entries.c_str()));
+
+  ASSERT_TRUE(cached);
+  ASSERT_NE(first_line.find("\"logs\":12"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":32"), std::string::npos);
+}
+
+TEST(job,testWorkers)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // two worker processes, the second file being split between them
+  std::string arg_line = "-fnames ../data/tests/sum.log,../data/tests/sum.log,../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format json -workers 2 -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  args.push_back("-worker_template");
+  args.push_back("../app/miw {args}");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  job j;
+  int status = j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+  remove(tmp_outputfile);
+
+  ASSERT_EQ(0, status);
+  ASSERT_NE(first_line.find("\"logs\":18"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":48"), std::string::npos);
+}
+
+TEST(job,testCompressed)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+  char gz_file[] = "/tmp/miw_gzXXXXXX";
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  int fd = mkstemp(gz_file);
+  ASSERT_TRUE(fd >= 0);
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // the log file, gzipped, merged with the log file itself
+  std::ifstream logfile("../data/tests/sum.log");
+  std::string logs((std::istreambuf_iterator<char>(logfile)),std::istreambuf_iterator<char>());
+  gzFile gz = gzdopen(fd,"wb");
+  ASSERT_EQ((int)logs.length(), gzwrite(gz,logs.data(),logs.length()));
+  ASSERT_EQ(Z_OK, gzclose(gz));
+  ASSERT_EQ(compressed_input::gzip, compressed_input::detect(gz_file));
+
+  std::string arg_line = "-fnames ";
+  arg_line.append(gz_file);
+  arg_line.append(",../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format json -merge_results -ofname ");
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  job j;
+  int status = j.execute(args.size()+1,cargs);
+
+  std::ifstream jsonfile(tmp_outputfile);
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+  remove(tmp_outputfile);
+  remove(gz_file);
+
+  ASSERT_EQ(0, status);
+  ASSERT_NE(first_line.find("\"logs\":12"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":32"), std::string::npos);
+}
+
+TEST(job,testCompressedShards)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+  char gz_file[] = "/tmp/miw_gzXXXXXX";
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  int fd = mkstemp(gz_file);
+  ASSERT_TRUE(fd >= 0);
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  std::ifstream logfile("../data/tests/sum.log");
+  std::string logs((std::istreambuf_iterator<char>(logfile)),std::istreambuf_iterator<char>());
+  gzFile gz = gzdopen(fd,"wb");
+  ASSERT_EQ((int)logs.length(), gzwrite(gz,logs.data(),logs.length()));
+  ASSERT_EQ(Z_OK, gzclose(gz));
+
+  // the compressed file merges the files in turn: the results are merged
+  // in the output file, not sharded
+  std::string arg_line = "-fnames ";
+  arg_line.append(gz_file);
+  arg_line.append(",../data/tests/sum.log -format_name ../miw/formats/tests/sum -output_format json -merge_results -output_shards 2 -order none -ofname ");
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  job j;
+  int status = j.execute(args.size()+1,cargs);
+  bool autosplit = j._autosplit;
+  bool shard = access((std::string(tmp_outputfile) + ".0").c_str(),F_OK) == 0;
+
+  std::ifstream jsonfile(tmp_outputfile);
+  std::string first_line;
+  std::getline(jsonfile, first_line);
+  remove(tmp_outputfile);
+  remove((std::string(tmp_outputfile) + ".0").c_str());
+  remove((std::string(tmp_outputfile) + ".1").c_str());
+  remove(gz_file);
+
+  ASSERT_EQ(0, status);
+  ASSERT_TRUE(autosplit);
+  ASSERT_FALSE(shard);
+  ASSERT_NE(first_line.find("\"logs\":12"), std::string::npos);
+  ASSERT_NE(first_line.find("\"v1\":32"), std::string::npos);
+}
+
+TEST(job,testCounter)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // a count-only format with a match condition, with and without the
+  // counter engine
+  std::string outputs[2];
+  bool counter[2];
+  for (int r=0;r<2;r++)
+    {
+      std::string arg_line = "-fnames ../data/tests/counter.log -format_name ../miw/formats/tests/match -output_format json -map_tasks 2 -skip_header -order key -counter=";
+      arg_line.append(r == 0 ? "true" : "false");
+      arg_line.append(" -ofname ");
+      arg_line.append(tmp_outputfile);
+      std::vector<std::string> args;
+      log_format::tokenize(arg_line,-1,args," ","");
+      char* cargs[args.size()+1];
+      cargs[0] = "miw";
+      for (size_t i=0;i<args.size();i++)
+	cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+      job j;
+      j.execute(args.size()+1,cargs);
+      counter[r] = j._counter;
+
+      std::ifstream jsonfile(tmp_outputfile);
+      outputs[r].assign((std::istreambuf_iterator<char>(jsonfile)),std::istreambuf_iterator<char>());
+      remove(tmp_outputfile);
+    }
+
+  ASSERT_TRUE(counter[0]);
+  ASSERT_FALSE(counter[1]);
+  ASSERT_EQ(std::string::npos, outputs[0].find("\"id\":\"id\""));
+  ASSERT_EQ(std::string::npos, outputs[0].find("\"id\":\"4\""));
+  ASSERT_NE(std::string::npos, outputs[0].find("\"id\":\"1\",\"logs\":3"));
+  ASSERT_NE(std::string::npos, outputs[0].find("\"id\":\"3\",\"logs\":2"));
+  ASSERT_EQ(outputs[1], outputs[0]);
+}
+
+TEST(job,testOutputShards)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  std::string arg_line = "-fnames ../data/tests/order.log -format_name ../miw/formats/tests/sum -output_format csv -output_shards 2 -order none -reduce_tasks 4 -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  job j;
+  j.execute(args.size()+1,cargs);
+  bool extra_shard = access((std::string(tmp_outputfile) + ".2").c_str(),F_OK) == 0;
+
+  // every shard starts with the header, and the shards hold every key once
+  std::vector<std::string> headers;
+  std::map<std::string,std::string> logs;
+  size_t nrows = 0;
+  for (int s=0;s<2;s++)
+    {
+      std::string shard = std::string(tmp_outputfile) + "." + std::to_string(s);
+      std::ifstream csvfile(shard);
+      std::string line;
+      if (std::getline(csvfile,line))
+	headers.push_back(line);
+      while (std::getline(csvfile,line))
+	{
+	  std::vector<std::string> cells;
+	  str_utils::str_split(line,',',cells);
+	  if (cells.size() > 2)
+	    logs[cells.at(1)] = cells.at(2);
+	  ++nrows;
+	}
+      remove(shard.c_str());
+    }
+  remove(tmp_outputfile);
+
+  ASSERT_FALSE(extra_shard);
+  ASSERT_EQ(2,headers.size());
+  ASSERT_EQ("format_name,id,logs,std_date_dt,v1,v2",headers.at(0));
+  ASSERT_EQ(headers.at(0),headers.at(1));
+  ASSERT_EQ(3,nrows);
+  ASSERT_EQ(3,logs.size());
+  ASSERT_EQ("1",logs["1"]);
+  ASSERT_EQ("3",logs["2"]);
+  ASSERT_EQ("2",logs["3"]);
+}
+
+TEST(job,testOutputShardsGenerated)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // the format generates fields that vary over the records: the shards
+  // share the columns of one of them
+  std::string arg_line = "-fnames ../data/tests/generated.log -format_name ../miw/formats/tests/generated -output_format csv -output_shards 2 -order none -reduce_tasks 4 -ofname ";
+  arg_line.append(tmp_outputfile);
+  std::vector<std::string> args;
+  log_format::tokenize(arg_line,-1,args," ","");
+  char* cargs[args.size()+1];
+  cargs[0] = "miw";
+  for (size_t i=0;i<args.size();i++)
+    cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+  job j;
+  j.execute(args.size()+1,cargs);
+
+  std::vector<std::string> headers;
+  std::vector<size_t> ncells;
+  for (int s=0;s<2;s++)
+    {
+      std::string shard = std::string(tmp_outputfile) + "." + std::to_string(s);
+      std::ifstream csvfile(shard);
+      std::string line;
+      if (std::getline(csvfile,line))
+	headers.push_back(line);
+      while (std::getline(csvfile,line))
+	ncells.push_back(std::count(line.begin(),line.end(),',') + 1);
+      remove(shard.c_str());
+    }
+  remove(tmp_outputfile);
+
+  ASSERT_EQ(2,headers.size());
+  ASSERT_EQ(headers.at(0),headers.at(1));
+  ASSERT_EQ(6,ncells.size());
+  size_t ncolumns = std::count(headers.at(0).begin(),headers.at(0).end(),',') + 1;
+  for (size_t i=0;i<ncells.size();i++)
+    ASSERT_EQ(ncolumns,ncells.at(i));
+}
+
+TEST(job,testSpillKeyCase)
+{
+  google::FlagSaver flag_saver;
+  char tmp_outputfile[L_tmpnam];
+
+  ASSERT_NE(NULL, tmpnam(tmp_outputfile));
+  std::cerr << "TMPFILE=" << tmp_outputfile << std::endl;
+
+  // keys differing in case only are one key, in memory and spilled
+  std::string outputs[2];
+  for (int r=0;r<2;r++)
+    {
+      std::string arg_line = "-fnames ../data/tests/case1.log,../data/tests/case2.log -format_name ../miw/formats/tests/match -output_format json -merge_results -order key -max_memory ";
+      arg_line.append(r == 0 ? "0" : "1");
+      arg_line.append(" -ofname ");
+      arg_line.append(tmp_outputfile);
+      std::vector<std::string> args;
+      log_format::tokenize(arg_line,-1,args," ","");
+      char* cargs[args.size()+1];
+      cargs[0] = "miw";
+      for (size_t i=0;i<args.size();i++)
+	cargs[i+1] = const_cast<char*>(args.at(i).c_str());
+      job j;
+      j.execute(args.size()+1,cargs);
+
+      // the merged record keeps the case of one of the keys
+      std::ifstream jsonfile(tmp_outputfile);
+      outputs[r].assign((std::istreambuf_iterator<char>(jsonfile)),std::istreambuf_iterator<char>());
+      std::transform(outputs[r].begin(),outputs[r].end(),outputs[r].begin(),::tolower);
+      remove(tmp_outputfile);
+    }
+
+  ASSERT_EQ(2, std::count(outputs[1].begin(),outputs[1].end(),'\n'));
+  ASSERT_NE(std::string::npos, outputs[1].find("\"id\":\"bar\",\"logs\":2"));
+  ASSERT_NE(std::string::npos, outputs[1].find("\"id\":\"foo\",\"logs\":3"));
+  ASSERT_EQ(outputs[0], outputs[1]);
+}